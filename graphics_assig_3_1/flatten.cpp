@@ -0,0 +1,269 @@
+#include "flatten.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLATTEN_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FLATTEN_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+// curves handled together by the kernels
+static const int LANES = 4;
+
+// A curve to flatten, always as a cubic: quadratics are raised to degree
+// three, which doesn't change their shape, so every lane does the same work
+struct FlatCurve
+{
+    vec2 points[4];
+    vec3 colours[4];
+    int  level;             // lines it is split into
+};
+
+// --------------------------------------------------------------------------
+// Four lanes of floats
+
+#if FLATTEN_SSE2
+
+typedef __m128 Lanes;
+static inline Lanes Splat(float value)                  { return _mm_set1_ps(value); }
+static inline Lanes Load(const float *values)           { return _mm_loadu_ps(values); }
+static inline Lanes Add(Lanes a, Lanes b)               { return _mm_add_ps(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b)               { return _mm_sub_ps(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b)               { return _mm_mul_ps(a, b); }
+static inline Lanes Min(Lanes a, Lanes b)               { return _mm_min_ps(a, b); }
+static inline void  Store(float *values, Lanes a)       { _mm_storeu_ps(values, a); }
+
+#elif FLATTEN_NEON
+
+typedef float32x4_t Lanes;
+static inline Lanes Splat(float value)                  { return vdupq_n_f32(value); }
+static inline Lanes Load(const float *values)           { return vld1q_f32(values); }
+static inline Lanes Add(Lanes a, Lanes b)               { return vaddq_f32(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b)               { return vsubq_f32(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b)               { return vmulq_f32(a, b); }
+static inline Lanes Min(Lanes a, Lanes b)               { return vminq_f32(a, b); }
+static inline void  Store(float *values, Lanes a)       { vst1q_f32(values, a); }
+
+#else
+
+// plain floats, which compilers can still vectorize on their own
+struct Lanes { float v[LANES]; };
+static inline Lanes Splat(float value)
+{
+    Lanes a;
+    for (int i = 0; i < LANES; i++) a.v[i] = value;
+    return a;
+}
+static inline Lanes Load(const float *values)
+{
+    Lanes a;
+    for (int i = 0; i < LANES; i++) a.v[i] = values[i];
+    return a;
+}
+static inline Lanes Add(Lanes a, Lanes b) { for (int i = 0; i < LANES; i++) a.v[i] += b.v[i]; return a; }
+static inline Lanes Sub(Lanes a, Lanes b) { for (int i = 0; i < LANES; i++) a.v[i] -= b.v[i]; return a; }
+static inline Lanes Mul(Lanes a, Lanes b) { for (int i = 0; i < LANES; i++) a.v[i] *= b.v[i]; return a; }
+static inline Lanes Min(Lanes a, Lanes b) { for (int i = 0; i < LANES; i++) a.v[i] = std::min(a.v[i], b.v[i]); return a; }
+static inline void  Store(float *values, Lanes a) { for (int i = 0; i < LANES; i++) values[i] = a.v[i]; }
+
+#endif
+
+const char *FlattenInstructionSet()
+{
+#if FLATTEN_SSE2
+    return "SSE2";
+#elif FLATTEN_NEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+// --------------------------------------------------------------------------
+// Building the curves
+
+// lines needed to stay within tolerance of a Bezier curve of the given
+// degree: sqrt(n(n-1)/8 * max|P[i] - 2P[i+1] + P[i+2]| / tolerance)
+static int CurveLevel(const vec2 *points, unsigned int degree, float tolerance)
+{
+    float bend = 0.f;
+    for (unsigned int i = 0; i + 2 <= degree; i++)
+        bend = std::max(bend, length(points[i] - 2.f * points[i + 1] + points[i + 2]));
+
+    float n = float(degree);
+    float level = std::ceil(std::sqrt(n * (n - 1.f) * bend / (8.f * tolerance)));
+    return int(std::min(std::max(level, 1.f), float(FLATTEN_MAX_LEVEL)));
+}
+
+// the curve through the given control points, raised to a cubic
+static FlatCurve MakeCurve(const vec2 *points, const vec3 *colours, unsigned int degree, float tolerance)
+{
+    FlatCurve curve;
+    curve.level = CurveLevel(points, degree, tolerance);
+    if (degree == 3) {
+        for (int k = 0; k < 4; k++) {
+            curve.points[k] = points[k];
+            curve.colours[k] = colours ? colours[k] : vec3(1.f);
+        }
+        return curve;
+    }
+
+    // the cubic with the same shape as the quadratic (q0, q1, q2) is
+    // (q0, q0 + 2/3 (q1 - q0), q2 + 2/3 (q1 - q2), q2)
+    const float twoThirds = 2.f / 3.f;
+    curve.points[0] = points[0];
+    curve.points[1] = mix(points[0], points[1], twoThirds);
+    curve.points[2] = mix(points[2], points[1], twoThirds);
+    curve.points[3] = points[2];
+
+    vec3 c0 = colours ? colours[0] : vec3(1.f);
+    vec3 c1 = colours ? colours[1] : vec3(1.f);
+    vec3 c2 = colours ? colours[2] : vec3(1.f);
+    curve.colours[0] = c0;
+    curve.colours[1] = mix(c0, c1, twoThirds);
+    curve.colours[2] = mix(c2, c1, twoThirds);
+    curve.colours[3] = c2;
+    return curve;
+}
+
+// --------------------------------------------------------------------------
+// Kernel
+
+// evaluates up to four curves together, one per lane, at the parameters of
+// their lines, appending the lines of each curve in turn; lanes stop once
+// their curve is done
+static void FlattenLanes(const FlatCurve *curves, int count, bool coloured,
+                         vector<vec2> *lines, vector<vec3> *lineColours)
+{
+    // the control points as structures of arrays, one lane per curve;
+    // missing lanes repeat the last curve, and are never written out
+    float x[4][LANES], y[4][LANES], r[4][LANES], g[4][LANES], b[4][LANES];
+    float levels[LANES], steps[LANES];
+    int maxLevel = 0;
+    size_t offsets[LANES];
+    size_t end = lines->size();
+    for (int lane = 0; lane < LANES; lane++) {
+        const FlatCurve &curve = curves[std::min(lane, count - 1)];
+        for (int k = 0; k < 4; k++) {
+            x[k][lane] = curve.points[k].x;
+            y[k][lane] = curve.points[k].y;
+            r[k][lane] = curve.colours[k].x;
+            g[k][lane] = curve.colours[k].y;
+            b[k][lane] = curve.colours[k].z;
+        }
+        levels[lane] = float(curve.level);
+        steps[lane] = 1.f / float(curve.level);
+        if (lane < count) {
+            maxLevel = std::max(maxLevel, curve.level);
+            offsets[lane] = end;
+            end += 2 * curve.level;
+        }
+    }
+    lines->resize(end);
+    if (coloured) lineColours->resize(end);
+
+    Lanes X[4], Y[4], R[4], G[4], B[4];
+    for (int k = 0; k < 4; k++) {
+        X[k] = Load(x[k]);
+        Y[k] = Load(y[k]);
+        R[k] = Load(r[k]);
+        G[k] = Load(g[k]);
+        B[k] = Load(b[k]);
+    }
+    const Lanes level = Load(levels);
+    const Lanes step = Load(steps);
+    const Lanes one = Splat(1.f);
+    const Lanes three = Splat(3.f);
+
+    vec2 previous[LANES];
+    vec3 previousColour[LANES];
+    for (int i = 0; i <= maxLevel; i++) {
+        // Bernstein weights at t = i / level, held at the end of the curve
+        // by lanes that have fewer lines
+        Lanes t = Mul(Min(Splat(float(i)), level), step);
+        Lanes u = Sub(one, t);
+        Lanes w0 = Mul(Mul(u, u), u);
+        Lanes w1 = Mul(Mul(three, t), Mul(u, u));
+        Lanes w2 = Mul(Mul(three, Mul(t, t)), u);
+        Lanes w3 = Mul(Mul(t, t), t);
+
+        float px[LANES], py[LANES];
+        Store(px, Add(Add(Mul(w0, X[0]), Mul(w1, X[1])), Add(Mul(w2, X[2]), Mul(w3, X[3]))));
+        Store(py, Add(Add(Mul(w0, Y[0]), Mul(w1, Y[1])), Add(Mul(w2, Y[2]), Mul(w3, Y[3]))));
+
+        float pr[LANES], pg[LANES], pb[LANES];
+        if (coloured) {
+            Store(pr, Add(Add(Mul(w0, R[0]), Mul(w1, R[1])), Add(Mul(w2, R[2]), Mul(w3, R[3]))));
+            Store(pg, Add(Add(Mul(w0, G[0]), Mul(w1, G[1])), Add(Mul(w2, G[2]), Mul(w3, G[3]))));
+            Store(pb, Add(Add(Mul(w0, B[0]), Mul(w1, B[1])), Add(Mul(w2, B[2]), Mul(w3, B[3]))));
+        }
+
+        for (int lane = 0; lane < count; lane++) {
+            if (i > curves[lane].level) continue;
+
+            vec2 point(px[lane], py[lane]);
+            vec3 colour = coloured ? vec3(pr[lane], pg[lane], pb[lane]) : vec3(1.f);
+            if (i > 0) {
+                size_t at = offsets[lane] + 2 * (i - 1);
+                (*lines)[at] = previous[lane];
+                (*lines)[at + 1] = point;
+                if (coloured) {
+                    (*lineColours)[at] = previousColour[lane];
+                    (*lineColours)[at + 1] = colour;
+                }
+            }
+            previous[lane] = point;
+            previousColour[lane] = colour;
+        }
+    }
+}
+
+static void FlattenCurves(const vector<FlatCurve> &curves, bool coloured,
+                          vector<vec2> *lines, vector<vec3> *lineColours)
+{
+    for (size_t i = 0; i < curves.size(); i += LANES) {
+        int count = int(std::min<size_t>(LANES, curves.size() - i));
+        FlattenLanes(&curves[i], count, coloured, lines, lineColours);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+void FlattenPatches(const vector<vec2> &points, const vector<vec3> &colours,
+                    const vector<GLubyte> &degrees, size_t first, size_t count, float tolerance,
+                    vector<vec2> *lines, vector<vec3> *lineColours)
+{
+    bool coloured = !colours.empty() && lineColours;
+    vector<FlatCurve> curves;
+    curves.reserve(count / 4);
+    for (size_t i = first; i + 4 <= first + count; i += 4) {
+        unsigned int degree = degrees[i];
+        if (degree < 2) continue;
+        curves.push_back(MakeCurve(&points[i], coloured ? &colours[i] : 0, degree, tolerance));
+    }
+    FlattenCurves(curves, coloured, lines, lineColours);
+}
+
+void FlattenGlyph(const MyGlyph &glyph, float tolerance, vector<vec2> *lines)
+{
+    vector<FlatCurve> curves;
+    curves.reserve(glyph.segmentCount);
+    for (unsigned int i = 0; i < glyph.segmentCount; i++) {
+        const MySegmentEntry &segment = glyph.segments[i];
+        if (segment.degree != 2 && segment.degree != 3) continue;
+
+        vec2 points[4];
+        for (unsigned int k = 0; k <= segment.degree; k++) {
+            const MyPoint &point = glyph.points[segment.offset + k];
+            points[k] = vec2(point.x, point.y);
+        }
+        curves.push_back(MakeCurve(points, 0, segment.degree, tolerance));
+    }
+    FlattenCurves(curves, false, lines, 0);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "fonts/GlyphExtractor.h"
+
+// --------------------------------------------------------------------------
+// Functions to flatten Bezier curves into lines on the CPU, for contexts
+// without tessellation shaders
+
+// Curves are split into as many lines as keep them within the tolerance of
+// the true curve (Wang's formula, as in tessControl.glsl), up to the same
+// limit as the tessellator. The lines are evaluated four curves at a time,
+// with SSE2 or NEON where the compiler targets them, and come out as
+// GL_LINES pairs, so they are drawn with the straight segments in one pass.
+
+// most lines a curve is split into
+const int FLATTEN_MAX_LEVEL = 64;
+
+// flattens patches of the demo curves: every four control points starting
+// at first make a patch, of which the first degree + 1 (its tag) are used.
+// Colours are optional, and blended along the curves like the tessellated
+// ones; tolerance is in the units of the points.
+void FlattenPatches(const std::vector<glm::vec2> &points, const std::vector<glm::vec3> &colours,
+                    const std::vector<GLubyte> &degrees, size_t first, size_t count, float tolerance,
+                    std::vector<glm::vec2> *lines, std::vector<glm::vec3> *lineColours);
+
+// flattens the quadratic and cubic segments of a glyph, with the tolerance
+// in EM units; its straight segments are left out
+void FlattenGlyph(const MyGlyph &glyph, float tolerance, std::vector<glm::vec2> *lines);
+
+// the instruction set the kernels were built for, for the startup report
+const char *FlattenInstructionSet();
@@ -0,0 +1,157 @@
+// ==========================================================================
+// Signed Distance Field Glyph Atlas
+//
+// Distances are found by brute force against a flattened copy of the
+// outline, and their sign from the nonzero winding rule, so both TrueType
+// and CFF contour directions work. Glyphs are rasterized once, when they
+// are first drawn, so the cost doesn't show up per frame.
+// ==========================================================================
+
+#include "DistanceField.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// line segments each curve of an outline is flattened into
+static const int QUADRATIC_STEPS = 8;
+static const int CUBIC_STEPS = 12;
+
+// empty texels between neighbouring cells, so filtering never mixes glyphs
+static const int CELL_GUTTER = 1;
+
+// --------------------------------------------------------------------------
+
+DistanceFieldAtlas::DistanceFieldAtlas(int width, int height, float texelsPerEm, float spread)
+    : m_width(width), m_height(height), m_texelsPerEm(texelsPerEm), m_spread(spread),
+      m_pixels(width * height, 0), m_shelfX(0), m_shelfY(0), m_shelfHeight(0)
+{}
+
+void DistanceFieldAtlas::Clear()
+{
+    fill(m_pixels.begin(), m_pixels.end(), 0);
+    m_shelfX = m_shelfY = m_shelfHeight = 0;
+}
+
+bool DistanceFieldAtlas::PackCell(int width, int height, int *x, int *y)
+{
+    if (width > m_width) return false;
+
+    // start a new shelf above the current one if the cell doesn't fit
+    if (m_shelfX + width > m_width) {
+        m_shelfY += m_shelfHeight + CELL_GUTTER;
+        m_shelfX = 0;
+        m_shelfHeight = 0;
+    }
+    if (m_shelfY + height > m_height) return false;
+
+    *x = m_shelfX;
+    *y = m_shelfY;
+    m_shelfX += width + CELL_GUTTER;
+    m_shelfHeight = max(m_shelfHeight, height);
+    return true;
+}
+
+void DistanceFieldAtlas::FlattenGlyph(const MyGlyph &glyph)
+{
+    m_edges.clear();
+
+    for (unsigned int i = 0; i < glyph.segmentCount; i++) {
+        const MySegmentEntry &entry = glyph.segments[i];
+        const MyPoint *p = &glyph.points[entry.offset];
+
+        int steps = (entry.degree == 3) ? CUBIC_STEPS :
+                    (entry.degree == 2) ? QUADRATIC_STEPS : 1;
+
+        float lastX = p[0].x, lastY = p[0].y;
+        for (int k = 1; k <= steps; k++) {
+            float t = float(k) / steps, s = 1.f - t;
+            float x = p[entry.degree].x, y = p[entry.degree].y;
+            if (entry.degree == 2) {
+                x = s*s*p[0].x + 2.f*s*t*p[1].x + t*t*p[2].x;
+                y = s*s*p[0].y + 2.f*s*t*p[1].y + t*t*p[2].y;
+            } else if (entry.degree == 3) {
+                x = s*s*s*p[0].x + 3.f*s*s*t*p[1].x + 3.f*s*t*t*p[2].x + t*t*t*p[3].x;
+                y = s*s*s*p[0].y + 3.f*s*s*t*p[1].y + 3.f*s*t*t*p[2].y + t*t*t*p[3].y;
+            }
+
+            Edge edge = { lastX, lastY, x, y };
+            m_edges.push_back(edge);
+            lastX = x;
+            lastY = y;
+        }
+    }
+}
+
+bool DistanceFieldAtlas::AddGlyph(const MyGlyph &glyph, DistanceFieldGlyph *placed)
+{
+    placed->advance = glyph.advance;
+    placed->empty = (glyph.segmentCount == 0);
+    if (placed->empty) return true;
+
+    FlattenGlyph(glyph);
+
+    // the flattened outline lies on the curves, so bound that
+    float minX = m_edges[0].x0, maxX = minX;
+    float minY = m_edges[0].y0, maxY = minY;
+    for (const Edge &edge : m_edges) {
+        minX = min(minX, edge.x1);  maxX = max(maxX, edge.x1);
+        minY = min(minY, edge.y1);  maxY = max(maxY, edge.y1);
+    }
+
+    // the cell spans the outline plus the spread on every side
+    float emPerTexel = 1.f / m_texelsPerEm;
+    int pad = int(ceil(m_spread));
+    int width = int(ceil((maxX - minX) * m_texelsPerEm)) + 2 * pad;
+    int height = int(ceil((maxY - minY) * m_texelsPerEm)) + 2 * pad;
+
+    int cellX, cellY;
+    if (!PackCell(width, height, &cellX, &cellY)) return false;
+
+    float originX = minX - pad * emPerTexel;
+    float originY = minY - pad * emPerTexel;
+
+    for (int row = 0; row < height; row++) {
+        for (int column = 0; column < width; column++) {
+
+            // texel centre in EM units
+            float x = originX + (column + 0.5f) * emPerTexel;
+            float y = originY + (row + 0.5f) * emPerTexel;
+
+            float nearest = 1e30f;
+            int winding = 0;
+            for (const Edge &edge : m_edges) {
+                float dx = edge.x1 - edge.x0, dy = edge.y1 - edge.y0;
+                float length2 = dx*dx + dy*dy;
+                float t = (length2 > 0.f) ? ((x - edge.x0)*dx + (y - edge.y0)*dy) / length2 : 0.f;
+                t = min(max(t, 0.f), 1.f);
+                float ex = edge.x0 + t*dx - x, ey = edge.y0 + t*dy - y;
+                nearest = min(nearest, ex*ex + ey*ey);
+
+                // winding of the outline around the texel, by crossings of
+                // the horizontal ray to its right
+                if ((edge.y0 <= y) != (edge.y1 <= y)) {
+                    float crossX = edge.x0 + (y - edge.y0) / dy * dx;
+                    if (crossX > x) winding += (dy > 0.f) ? 1 : -1;
+                }
+            }
+
+            float distance = sqrt(nearest) * m_texelsPerEm;
+            if (winding == 0) distance = -distance;
+
+            float value = 128.f + distance * 127.f / m_spread;
+            m_pixels[(cellY + row) * m_width + cellX + column] =
+                (unsigned char)(min(max(value, 0.f), 255.f));
+        }
+    }
+
+    placed->left = originX;
+    placed->bottom = originY;
+    placed->right = originX + width * emPerTexel;
+    placed->top = originY + height * emPerTexel;
+    placed->u0 = float(cellX) / m_width;
+    placed->v0 = float(cellY) / m_height;
+    placed->u1 = float(cellX + width) / m_width;
+    placed->v1 = float(cellY + height) / m_height;
+    return true;
+}
@@ -0,0 +1,81 @@
+// ==========================================================================
+// Signed Distance Field Glyph Atlas
+//
+// This module rasterizes glyph outlines from a GlyphExtractor into a single
+// image of signed distances, ready to upload as a one-channel texture. Each
+// glyph covers a cell of the image; cells are packed into shelves, rows of
+// cells as tall as the tallest cell on them. A glyph drawn from the atlas
+// is a single textured quad, and stays sharp when scaled up as long as the
+// shader thresholds the interpolated distance rather than the texel.
+// ==========================================================================
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include <vector>
+
+#include "GlyphExtractor.h"
+
+// --------------------------------------------------------------------------
+// Placement of one glyph in the atlas
+
+struct DistanceFieldGlyph
+{
+    // quad to draw, in EM-box coordinates, including the distance spread
+    float left, bottom, right, top;
+
+    // texture coordinates of the quad's corners
+    float u0, v0, u1, v1;
+
+    // advance width to next glyph, in EM units
+    float advance;
+
+    // the glyph has no outline, so there is nothing to draw
+    bool empty;
+};
+
+// --------------------------------------------------------------------------
+// Texels are 0 to 255, with 128 on the outline. Distances grow inwards and
+// are clamped at the spread, in texels, on either side of the outline.
+
+class DistanceFieldAtlas
+{
+    int     m_width;
+    int     m_height;
+    float   m_texelsPerEm;
+    float   m_spread;
+
+    // row-major texels, the first row at texture coordinate v = 0
+    std::vector<unsigned char> m_pixels;
+
+    // next free position on the current shelf, and the shelf's height
+    int     m_shelfX;
+    int     m_shelfY;
+    int     m_shelfHeight;
+
+    // scratch polyline edges of the glyph being rasterized
+    struct Edge { float x0, y0, x1, y1; };
+    std::vector<Edge> m_edges;
+
+    // reserves a cell of the given size, returning false if the atlas is full
+    bool PackCell(int width, int height, int *x, int *y);
+
+    // appends a glyph's outline to m_edges, flattening any curves
+    void FlattenGlyph(const MyGlyph &glyph);
+
+public:
+    DistanceFieldAtlas(int width = 1024, int height = 1024,
+                       float texelsPerEm = 48.f, float spread = 4.f);
+
+    // rasterizes a glyph into a free cell, returning its placement; returns
+    // false, leaving the atlas unchanged, if there's no room left
+    bool AddGlyph(const MyGlyph &glyph, DistanceFieldGlyph *placed);
+
+    // empties the atlas, keeping its size
+    void Clear();
+
+    const unsigned char *Pixels() const { return m_pixels.data(); }
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+};
+
+#endif // DISTANCEFIELD_H
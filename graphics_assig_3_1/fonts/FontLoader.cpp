@@ -0,0 +1,157 @@
+// ==========================================================================
+// Background Font Loading
+//
+// The loading thread sleeps until a request arrives, then takes every
+// request waiting and decodes them as one batch of jobs, each font's
+// character set on a worker of its own. Fonts are handed back in the order
+// they were requested once the batch is done; a destroyed loader drops the
+// requests it hasn't started.
+// ==========================================================================
+
+#include "FontLoader.h"
+
+using namespace std;
+
+const string PRINTABLE_ASCII =
+    " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`"
+    "abcdefghijklmnopqrstuvwxyz{|}~";
+
+// --------------------------------------------------------------------------
+
+bool LoadedFont::LayOut(string_view text, GlyphRun *run) const
+{
+    DecodeUTF8(text, &run->characters);
+    run->glyphs.clear();
+    run->pens.clear();
+    run->advance = 0.f;
+    run->loaded = loaded;
+    run->font = shared_from_this();
+    run->arena.reset();
+    if (!loaded) return false;
+
+    const vector<int> &characters = run->characters;
+    run->glyphs.reserve(characters.size());
+    run->pens.reserve(characters.size());
+    for (size_t i = 0; i < characters.size(); ++i)
+    {
+        auto found = glyphs.find(characters[i]);
+        if (found == glyphs.end()) return false;
+
+        if (i > 0) run->advance += kerning.Adjustment(characters[i - 1], characters[i]);
+
+        run->glyphs.push_back(found->second);
+        run->pens.push_back(run->advance);
+        run->advance += found->second.advance;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+FontLoader::FontLoader()
+    : m_quit(false)
+{
+    m_thread = thread(&FontLoader::Work, this);
+}
+
+FontLoader::~FontLoader()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void FontLoader::Load(const string &fontFile, const string &charset)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        Request request = { fontFile, charset };
+        m_requests.push_back(request);
+    }
+    m_wake.notify_one();
+}
+
+bool FontLoader::Poll(vector<shared_ptr<const LoadedFont> > *ready)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_ready.empty()) return false;
+
+    ready->insert(ready->end(), m_ready.begin(), m_ready.end());
+    m_ready.clear();
+    return true;
+}
+
+void FontLoader::SetReadyCallback(function<void()> onReady)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_onReady = onReady;
+}
+
+// --------------------------------------------------------------------------
+
+void FontLoader::Work()
+{
+    vector<Request> requests;
+    vector<GlyphRun> runs;
+    vector<KerningTable> kernings;
+    vector<GlyphJob> jobs;
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_quit || !m_requests.empty(); });
+            if (m_quit) return;
+
+            requests.assign(m_requests.begin(), m_requests.end());
+            m_requests.clear();
+        }
+
+        // decode outside the lock, so the render thread never waits on it;
+        // the runs are only read once every job is done, so they can't move
+        runs.assign(requests.size(), GlyphRun());
+        kernings.assign(requests.size(), KerningTable());
+        jobs.clear();
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            GlyphJob job = { requests[i].fontFile, requests[i].charset, &runs[i], &kernings[i] };
+            jobs.push_back(job);
+        }
+        m_service.Run(jobs);
+
+        vector<shared_ptr<const LoadedFont> > fonts;
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            const GlyphRun &run = runs[i];
+            shared_ptr<LoadedFont> font(new LoadedFont());
+            font->fontFile = requests[i].fontFile;
+            font->loaded = run.loaded;
+
+            // the worker's copies are sized first, so the arena holds them
+            // all in one block
+            size_t tableBytes = 0;
+            for (const MyGlyph &glyph : run.glyphs)
+                tableBytes += glyph.TableBytes();
+            font->arena.Reserve(tableBytes);
+            font->glyphs.reserve(run.characters.size());
+            for (size_t k = 0; k < run.characters.size(); ++k)
+                font->glyphs[run.characters[k]] = run.glyphs[k].CopyTo(&font->arena);
+
+            // every pair of the character set, so layouts never need FreeType
+            font->kerning = move(kernings[i]);
+            fonts.push_back(font);
+        }
+
+        function<void()> onReady;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_ready.insert(m_ready.end(), fonts.begin(), fonts.end());
+            onReady = m_onReady;
+        }
+        if (onReady) onReady();
+    }
+}
+
+// --------------------------------------------------------------------------
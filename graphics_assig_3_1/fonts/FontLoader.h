@@ -0,0 +1,105 @@
+// ==========================================================================
+// Background Font Loading
+//
+// Opening a large face and decoding its glyphs can take longer than a
+// frame. A FontLoader does both on a thread of its own, with its own
+// GlyphService, and hands back each font as an immutable LoadedFont once
+// all the glyphs of its character set are decoded. Fonts requested together
+// are decoded together, one per worker, so a start up that asks for several
+// doesn't decode them one after another. The render thread polls for
+// finished fonts and switches to them when they're ready, drawing with
+// whatever it had until then.
+// ==========================================================================
+#ifndef FONTLOADER_H
+#define FONTLOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "GlyphService.h"
+
+// --------------------------------------------------------------------------
+// Characters decoded ahead of time unless a request says otherwise: the
+// printable ASCII range. Character sets are UTF-8, like the text.
+
+extern const std::string PRINTABLE_ASCII;
+
+// A font whose glyphs have been decoded in the background. It is never
+// changed once published, so any thread may read it. It is always owned by
+// a shared_ptr, which the runs laid out from it share.
+struct LoadedFont : std::enable_shared_from_this<LoadedFont>
+{
+    std::string     fontFile;
+    bool            loaded;     // the file could be opened
+
+    // decoded glyphs, by character code, with their outlines in the arena,
+    // and the kerning between them
+    GlyphArena      arena;
+    std::unordered_map<int, MyGlyph> glyphs;
+    KerningTable    kerning;
+
+    LoadedFont() : loaded(false)
+    {}
+
+    // lays a string out from the decoded glyphs, as GlyphService does;
+    // returns false if a character isn't in the font's character set. The
+    // run's glyphs point into the arena, so the run holds on to the font.
+    bool LayOut(std::string_view text, GlyphRun *run) const;
+};
+
+// --------------------------------------------------------------------------
+
+class FontLoader
+{
+    struct Request
+    {
+        std::string fontFile;
+        std::string charset;
+    };
+
+    // only touched by the loading thread
+    GlyphService    m_service;
+
+    // requests not yet started, and fonts finished but not yet collected,
+    // both guarded by m_mutex
+    std::mutex                  m_mutex;
+    std::condition_variable     m_wake;
+    std::deque<Request>         m_requests;
+    std::vector<std::shared_ptr<const LoadedFont> > m_ready;
+    std::function<void()>       m_onReady;
+    bool                        m_quit;
+
+    std::thread                 m_thread;
+
+    // loading thread: decodes requests in order until told to quit
+    void Work();
+
+public:
+    FontLoader();
+    ~FontLoader();
+
+    FontLoader(const FontLoader &) = delete;
+    FontLoader &operator=(const FontLoader &) = delete;
+
+    // queues a font to be opened and the given characters decoded
+    void Load(const std::string &fontFile, const std::string &charset = PRINTABLE_ASCII);
+
+    // moves the fonts finished since the last call into ready, without
+    // waiting; returns false if there were none
+    bool Poll(std::vector<std::shared_ptr<const LoadedFont> > *ready);
+
+    // called on the loading thread whenever a font is finished, e.g. to wake
+    // a render loop waiting for events; none if empty
+    void SetReadyCallback(std::function<void()> onReady);
+};
+
+// --------------------------------------------------------------------------
+#endif // FONTLOADER_H
@@ -0,0 +1,241 @@
+// ==========================================================================
+// Binary Glyph Outline Cache Files
+//
+// Files are written under a temporary name and then renamed over the old
+// cache, so a reader, in this process or another, never sees half a file.
+// Stamping a cache writes a whole new copy of it the same way, rather than
+// patching a file that others may have mapped, or replaced since.
+// ==========================================================================
+
+#include "GlyphCache.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "MappedFile.h"
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#include <unistd.h>
+#define GLYPHCACHE_POSIX 1
+#endif
+
+using namespace std;
+
+static const char GLYPH_CACHE_MAGIC[8] = { 'G', 'L', 'Y', 'P', 'H', 'S', 0, 0 };
+
+// temporary files written so far by this process
+static atomic<unsigned int> s_temporaries(0);
+
+// --------------------------------------------------------------------------
+
+uint64_t HashFontData(const unsigned char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+string GlyphCachePath(const string &fontFile)
+{
+    return fontFile + ".glyphs";
+}
+
+// --------------------------------------------------------------------------
+
+// a temporary name of its own for every file written, so writers in other
+// threads or processes never write to the same one
+static string TemporaryPath(const string &path)
+{
+    unsigned long process = 0;
+#if GLYPHCACHE_POSIX
+    process = getpid();
+#endif
+    return path + ".tmp" + to_string(process) + "-" + to_string(s_temporaries++);
+}
+
+// whether path still names the given mapped file, and not one renamed over it
+static bool IsSameFile(const string &path, const MappedFile &file)
+{
+#if GLYPHCACHE_POSIX
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 && uint64_t(status.st_ino) == file.FileId();
+#else
+    return false;
+#endif
+}
+
+// writes a cache file with write(), under a temporary name that is then
+// renamed to path, unless replacing is given and path no longer names it
+template <typename Writer>
+static bool ReplaceGlyphCache(const string &path, const MappedFile *replacing, Writer write)
+{
+    string temporary = TemporaryPath(path);
+    ofstream file(temporary.c_str(), ios::binary | ios::trunc);
+    if (!file) return false;
+
+    write(file);
+    file.close();
+    if (!file || (replacing && !IsSameFile(path, *replacing)) ||
+        rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// points the cache at the font file it was just checked against, so the
+// next check can skip hashing it; the new copy is dropped if the cache was
+// replaced meanwhile, since the replacement is stamped already
+static void StampGlyphCache(const string &path, const MappedFile &cache, const MappedFile &font)
+{
+    GlyphCacheHeader header;
+    memcpy(&header, cache.Data(), sizeof(header));
+    header.fontModified = font.ModifiedTime();
+    header.fontInode = font.FileId();
+
+    ReplaceGlyphCache(path, &cache, [&](ofstream &file) {
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(cache.Data() + sizeof(header)), cache.Size() - sizeof(header));
+    });
+}
+
+bool ReadGlyphCache(const string &path, const MappedFile &font, uint64_t *fontHash,
+                    unordered_map<int, MyGlyph> *glyphs, KerningTable *kerning,
+                    GlyphArena *arena)
+{
+    *fontHash = 0;
+    shared_ptr<const MappedFile> file = MappedFile::Open(path);
+    if (!file || file->Size() < sizeof(GlyphCacheHeader)) return false;
+
+    const unsigned char *data = file->Data();
+    const GlyphCacheHeader *header = reinterpret_cast<const GlyphCacheHeader *>(data);
+    if (memcmp(header->magic, GLYPH_CACHE_MAGIC, sizeof(GLYPH_CACHE_MAGIC)) != 0 ||
+        header->version != GLYPH_CACHE_VERSION || header->fontSize != font.Size())
+        return false;
+
+    // the same file as last time, or one with the same contents
+    bool stamped = header->fontModified == font.ModifiedTime() && header->fontInode == font.FileId();
+    if (!stamped)
+    {
+        *fontHash = HashFontData(font.Data(), font.Size());
+        if (header->fontHash != *fontHash) return false;
+    }
+    *fontHash = header->fontHash;
+
+    // the tables must fit in the file exactly
+    size_t recordBytes = size_t(header->glyphCount) * sizeof(GlyphCacheRecord);
+    size_t pointBytes = size_t(header->pointCount) * sizeof(MyPoint);
+    size_t segmentBytes = size_t(header->segmentCount) * sizeof(MySegmentEntry);
+    size_t contourBytes = size_t(header->contourCount) * sizeof(MyContour);
+    size_t kerningBytes = size_t(header->kerningCount) * sizeof(GlyphCacheKerning);
+    if (file->Size() != sizeof(GlyphCacheHeader) + recordBytes + pointBytes + segmentBytes +
+                        contourBytes + kerningBytes)
+        return false;
+
+    const unsigned char *base = data + sizeof(GlyphCacheHeader);
+    const GlyphCacheRecord *records = reinterpret_cast<const GlyphCacheRecord *>(base);
+    const MyPoint *points = reinterpret_cast<const MyPoint *>(base + recordBytes);
+    const MySegmentEntry *segments = reinterpret_cast<const MySegmentEntry *>(base + recordBytes + pointBytes);
+    const MyContour *contours = reinterpret_cast<const MyContour *>(base + recordBytes + pointBytes + segmentBytes);
+    const GlyphCacheKerning *pairs =
+        reinterpret_cast<const GlyphCacheKerning *>(base + recordBytes + pointBytes + segmentBytes + contourBytes);
+
+    for (uint32_t i = 0; i < header->glyphCount; ++i)
+    {
+        const GlyphCacheRecord &record = records[i];
+        if (uint64_t(record.pointFirst) + record.pointCount > header->pointCount ||
+            uint64_t(record.segmentFirst) + record.segmentCount > header->segmentCount ||
+            uint64_t(record.contourFirst) + record.contourCount > header->contourCount)
+            return false;
+    }
+
+    // all the tables in one block
+    arena->Reserve(pointBytes + segmentBytes + contourBytes);
+    for (uint32_t i = 0; i < header->glyphCount; ++i)
+    {
+        const GlyphCacheRecord &record = records[i];
+        MyGlyph &glyph = (*glyphs)[record.character];
+        glyph.advance = record.advance;
+        glyph.Pack(points + record.pointFirst, record.pointCount,
+                   segments + record.segmentFirst, record.segmentCount,
+                   contours + record.contourFirst, record.contourCount, arena);
+    }
+    for (uint32_t i = 0; i < header->kerningCount; ++i)
+        kerning->pairs[KerningTable::Pair(pairs[i].left, pairs[i].right)] = pairs[i].adjustment;
+
+    if (!stamped) StampGlyphCache(path, *file, font);
+    return true;
+}
+
+bool WriteGlyphCache(const string &path, const MappedFile &font, uint64_t fontHash,
+                     const unordered_map<int, MyGlyph> &glyphs, const KerningTable &kerning)
+{
+    GlyphCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GLYPH_CACHE_MAGIC, sizeof(GLYPH_CACHE_MAGIC));
+    header.fontHash = fontHash;
+    header.fontSize = font.Size();
+    header.fontModified = font.ModifiedTime();
+    header.fontInode = font.FileId();
+    header.version = GLYPH_CACHE_VERSION;
+
+    vector<GlyphCacheRecord> records;
+    records.reserve(glyphs.size());
+    for (const auto &entry : glyphs)
+    {
+        const MyGlyph &glyph = entry.second;
+        GlyphCacheRecord record;
+        record.character = entry.first;
+        record.advance = glyph.advance;
+        record.pointFirst = header.pointCount;
+        record.pointCount = glyph.pointCount;
+        record.segmentFirst = header.segmentCount;
+        record.segmentCount = glyph.segmentCount;
+        record.contourFirst = header.contourCount;
+        record.contourCount = glyph.contourCount;
+        records.push_back(record);
+
+        header.pointCount += glyph.pointCount;
+        header.segmentCount += glyph.segmentCount;
+        header.contourCount += glyph.contourCount;
+    }
+    header.glyphCount = records.size();
+
+    // only pairs of cached glyphs, which every reader can then rely on
+    vector<GlyphCacheKerning> pairs;
+    for (const auto &entry : kerning.pairs)
+    {
+        GlyphCacheKerning pair;
+        pair.left = int32_t(entry.first >> 32);
+        pair.right = int32_t(uint32_t(entry.first));
+        pair.adjustment = entry.second;
+        if (pair.adjustment != 0.f && glyphs.count(pair.left) && glyphs.count(pair.right))
+            pairs.push_back(pair);
+    }
+    header.kerningCount = pairs.size();
+
+    return ReplaceGlyphCache(path, 0, [&](ofstream &file) {
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(GlyphCacheRecord));
+
+        // each table in turn, in the same glyph order as the records
+        for (const auto &entry : glyphs)
+            file.write(reinterpret_cast<const char *>(entry.second.points), entry.second.pointCount * sizeof(MyPoint));
+        for (const auto &entry : glyphs)
+            file.write(reinterpret_cast<const char *>(entry.second.segments), entry.second.segmentCount * sizeof(MySegmentEntry));
+        for (const auto &entry : glyphs)
+            file.write(reinterpret_cast<const char *>(entry.second.contours), entry.second.contourCount * sizeof(MyContour));
+        file.write(reinterpret_cast<const char *>(pairs.data()), pairs.size() * sizeof(GlyphCacheKerning));
+    });
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,97 @@
+// ==========================================================================
+// Binary Glyph Outline Cache Files
+//
+// Converting outlines from FreeType (on/off-curve tags, implicit midpoints,
+// scaling to the EM box) is only done once per font: the converted glyphs
+// are saved next to the font file, and read back on later runs without
+// FreeType being involved at all.
+//
+// A cache file is a header, a record per glyph, then the points, segment
+// tables and contour tables of all the glyphs back to back, exactly as
+// MyGlyph packs them, and last the kerned pairs among the glyphs, so that
+// laying them out doesn't need FreeType either. Every field is 4 or 8
+// bytes and naturally aligned, so the file can be used straight from a
+// read-only mapping. It is only valid for the font file it was made from,
+// identified by size and hash, and on machines of the same byte order.
+// Hashing reads the whole font, so the header also stamps it with the
+// font's modification time and inode, and the hash is only checked when
+// they've changed, e.g. after the font was copied. A cache thus holds a
+// font's glyphs and kerning for as long as the font is unchanged.
+// ==========================================================================
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "GlyphExtractor.h"
+
+class MappedFile;
+
+// --------------------------------------------------------------------------
+// File layout, bumped whenever it or the glyph conversion changes
+
+const uint32_t GLYPH_CACHE_VERSION = 3;
+
+struct GlyphCacheHeader
+{
+    char        magic[8];       // "GLYPHS\0\0"
+    uint64_t    fontHash;       // of the font file's contents
+    uint64_t    fontSize;       // in bytes
+    uint64_t    fontModified;   // modification time (ns) and inode of the
+    uint64_t    fontInode;      // font file the hash was last checked on
+    uint32_t    version;
+    uint32_t    glyphCount;
+    uint32_t    pointCount;     // totals over all the glyphs
+    uint32_t    segmentCount;
+    uint32_t    contourCount;
+    uint32_t    kerningCount;   // pairs with kerning; pairs of the glyphs
+                                // that aren't listed have none
+};
+
+// one glyph: its character, advance, and ranges of the shared tables; the
+// offsets inside its segments and contours are relative to its own ranges
+struct GlyphCacheRecord
+{
+    int32_t     character;
+    float       advance;
+    uint32_t    pointFirst, pointCount;
+    uint32_t    segmentFirst, segmentCount;
+    uint32_t    contourFirst, contourCount;
+};
+
+// the kerning of one pair of characters, in EM units
+struct GlyphCacheKerning
+{
+    int32_t     left, right;
+    float       adjustment;
+};
+
+// --------------------------------------------------------------------------
+
+// 64-bit FNV-1a hash of a font file's contents
+uint64_t HashFontData(const unsigned char *data, size_t size);
+
+// where the cache of a font file is kept
+std::string GlyphCachePath(const std::string &fontFile);
+
+// adds the glyphs of a cache file to glyphs, with their tables packed into
+// arena, and its kerned pairs to kerning, returning false (and adding
+// nothing) if there is none, or it isn't valid for the mapped font. The
+// font is only hashed, into fontHash, if its modification time or inode
+// changed; a cache that still matches the hash is then replaced by a copy
+// stamped with them, so it isn't hashed again. fontHash is 0 if the font wasn't hashed.
+bool ReadGlyphCache(const std::string &path, const MappedFile &font, uint64_t *fontHash,
+                    std::unordered_map<int, MyGlyph> *glyphs, KerningTable *kerning,
+                    GlyphArena *arena);
+
+// saves glyphs, and every kerned pair among them, as the cache of the
+// mapped font, whose contents have the given hash, replacing any cache
+// file there was
+bool WriteGlyphCache(const std::string &path, const MappedFile &font, uint64_t fontHash,
+                     const std::unordered_map<int, MyGlyph> &glyphs, const KerningTable &kerning);
+
+// --------------------------------------------------------------------------
+#endif // GLYPHCACHE_H
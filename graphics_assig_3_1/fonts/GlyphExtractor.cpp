@@ -6,9 +6,13 @@
 // well as a GlyphExtractor class that will retrieve glyph outlines from a
 // font file for specified characters. Data structures are as follows:
 //  - A glyph consists of zero or more contours, plus an advance width
-//  - A contour consists of one or more segments (stored as std::vector)
+//  - A contour consists of one or more segments (a range of the segment table)
 //  - A segment is either a straight line, quadratic Bezier, or cubic Bezier
 //
+// A glyph's points, segment table and contour table are packed together in
+// a single allocation, or in a GlyphArena shared with other glyphs; segments
+// in a contour share their end points.
+//
 // You may use this code (or not) however you see fit for your work.
 //
 // Author:  Sonny Chan
@@ -17,7 +21,11 @@
 // ==========================================================================
 
 #include "GlyphExtractor.h"
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+
+#include "GlyphCache.h"
 
 // set this true to print information about the font loaded and glyphs extracted
 #define DEBUG_PRINT 0
@@ -26,44 +34,382 @@ using namespace std;
 
 // --------------------------------------------------------------------------
 
-GlyphExtractor::GlyphExtractor()
-    : m_face(0)
+// blocks big enough for a few hundred typical glyphs
+static const size_t ARENA_BLOCK_BYTES = 64 * 1024;
+
+GlyphArena::GlyphArena()
+    : m_used(0), m_capacity(0)
+{}
+
+void GlyphArena::Reserve(size_t bytes)
+{
+    if (m_capacity - m_used >= bytes) return;
+
+    m_blocks.push_back(unique_ptr<unsigned char[]>(new unsigned char[bytes]));
+    m_used = 0;
+    m_capacity = bytes;
+}
+
+void *GlyphArena::Allocate(size_t bytes)
+{
+    bytes = (bytes + 3) & ~size_t(3);
+    if (m_capacity - m_used < bytes) Reserve(max(bytes, ARENA_BLOCK_BYTES));
+
+    void *memory = m_blocks.back().get() + m_used;
+    m_used += bytes;
+    return memory;
+}
+
+// --------------------------------------------------------------------------
+
+MyGlyph::MyGlyph(float adv)
+    : advance(adv), bounds(), pointCount(0), segmentCount(0), contourCount(0),
+      points(0), segments(0), contours(0)
+{}
+
+MyGlyph::MyGlyph(const MyGlyph &other)
+    : advance(other.advance), bounds(other.bounds), pointCount(other.pointCount),
+      segmentCount(other.segmentCount), contourCount(other.contourCount),
+      points(other.points), segments(other.segments), contours(other.contours),
+      m_storage(other.m_storage)
+{
+    if (!m_storage.empty()) Link();
+}
+
+MyGlyph &MyGlyph::operator=(const MyGlyph &other)
+{
+    advance = other.advance;
+    bounds = other.bounds;
+    pointCount = other.pointCount;
+    segmentCount = other.segmentCount;
+    contourCount = other.contourCount;
+    m_storage = other.m_storage;
+    points = other.points;
+    segments = other.segments;
+    contours = other.contours;
+    if (!m_storage.empty()) Link();
+    return *this;
+}
+
+size_t MyGlyph::TableBytes() const
+{
+    return pointCount * sizeof(MyPoint) + segmentCount * sizeof(MySegmentEntry) +
+           contourCount * sizeof(MyContour);
+}
+
+MyGlyph MyGlyph::CopyTo(GlyphArena *arena) const
+{
+    MyGlyph copy(advance);
+    copy.bounds = bounds;
+    copy.pointCount = pointCount;
+    copy.segmentCount = segmentCount;
+    copy.contourCount = contourCount;
+    if (TableBytes() == 0) return copy;
+
+    // laid out as Pack() does
+    unsigned char *base = static_cast<unsigned char *>(arena->Allocate(TableBytes()));
+    memcpy(base, points, pointCount * sizeof(MyPoint));
+    copy.points = reinterpret_cast<const MyPoint *>(base);
+    base += pointCount * sizeof(MyPoint);
+    memcpy(base, segments, segmentCount * sizeof(MySegmentEntry));
+    copy.segments = reinterpret_cast<const MySegmentEntry *>(base);
+    base += segmentCount * sizeof(MySegmentEntry);
+    memcpy(base, contours, contourCount * sizeof(MyContour));
+    copy.contours = reinterpret_cast<const MyContour *>(base);
+    return copy;
+}
+
+void MyGlyph::Pack(const vector<MyPoint> &pointTable,
+                   const vector<MySegmentEntry> &segmentTable,
+                   const vector<MyContour> &contourTable, GlyphArena *arena)
+{
+    Pack(pointTable.data(), pointTable.size(), segmentTable.data(), segmentTable.size(),
+         contourTable.data(), contourTable.size(), arena);
+}
+
+void MyGlyph::Pack(const MyPoint *pointTable, unsigned int points,
+                   const MySegmentEntry *segmentTable, unsigned int segments,
+                   const MyContour *contourTable, unsigned int contours, GlyphArena *arena)
+{
+    pointCount = points;
+    segmentCount = segments;
+    contourCount = contours;
+
+    // points, then segments, then contours; every table is 4-byte aligned
+    size_t pointBytes = pointCount * sizeof(MyPoint);
+    size_t segmentBytes = segmentCount * sizeof(MySegmentEntry);
+    size_t contourBytes = contourCount * sizeof(MyContour);
+    size_t bytes = pointBytes + segmentBytes + contourBytes;
+    unsigned char *base = 0;
+    if (arena)
+    {
+        // laid out as Link() does
+        m_storage.clear();
+        if (bytes) base = static_cast<unsigned char *>(arena->Allocate(bytes));
+        this->points = reinterpret_cast<const MyPoint *>(base);
+        this->segments = reinterpret_cast<const MySegmentEntry *>(base ? base + pointBytes : 0);
+        this->contours = reinterpret_cast<const MyContour *>(base ? base + pointBytes + segmentBytes : 0);
+    }
+    else
+    {
+        m_storage.resize(bytes);
+        Link();
+        if (bytes) base = &m_storage[0];
+    }
+
+    if (pointBytes)   memcpy(base, pointTable, pointBytes);
+    if (segmentBytes) memcpy(base + pointBytes, segmentTable, segmentBytes);
+    if (contourBytes) memcpy(base + pointBytes + segmentBytes, contourTable, contourBytes);
+
+    bounds = MyBounds();
+    if (pointCount) {
+        bounds.xMin = bounds.xMax = pointTable[0].x;
+        bounds.yMin = bounds.yMax = pointTable[0].y;
+    }
+    for (unsigned int i = 1; i < pointCount; ++i) {
+        const MyPoint &point = pointTable[i];
+        bounds.xMin = min(bounds.xMin, point.x);
+        bounds.yMin = min(bounds.yMin, point.y);
+        bounds.xMax = max(bounds.xMax, point.x);
+        bounds.yMax = max(bounds.yMax, point.y);
+    }
+}
+
+void MyGlyph::Link()
+{
+    if (m_storage.empty()) {
+        points = 0;
+        segments = 0;
+        contours = 0;
+        return;
+    }
+
+    unsigned char *base = &m_storage[0];
+    points = reinterpret_cast<const MyPoint *>(base);
+    base += pointCount * sizeof(MyPoint);
+    segments = reinterpret_cast<const MySegmentEntry *>(base);
+    base += segmentCount * sizeof(MySegmentEntry);
+    contours = reinterpret_cast<const MyContour *>(base);
+}
+
+MySegment MyGlyph::Segment(unsigned int index) const
+{
+    const MySegmentEntry &entry = segments[index];
+    MySegment segment(entry.degree);
+    for (unsigned int i = 0; i <= entry.degree; ++i) {
+        segment.x[i] = points[entry.offset + i].x;
+        segment.y[i] = points[entry.offset + i].y;
+    }
+    return segment;
+}
+
+// --------------------------------------------------------------------------
+
+GlyphExtractor::GlyphExtractor(size_t maxFaces)
+    : m_library(0), m_face(0), m_current(INVALID_FONT), m_currentEntry(0),
+      m_nextHandle(0), m_clock(0), m_maxFaces(maxFaces), m_mapFiles(true)
 {
     // initialize freetype library
     FT_Error error = FT_Init_FreeType(&m_library);
     if (error) {
         cout << "ERROR: FreeType failed to initialize!" << endl;
+        m_library = 0;
     }
 }
 
+GlyphExtractor::~GlyphExtractor()
+{
+    for (auto &entry : m_faces)
+        if (entry.second.face) FT_Done_Face(entry.second.face);
+    if (m_library) FT_Done_FreeType(m_library);
+}
+
 // --------------------------------------------------------------------------
 
 bool GlyphExtractor::LoadFontFile(const string &filename)
 {
-    FT_Error error = FT_New_Face(m_library, filename.c_str(), 0, &m_face);
+    FontHandle handle = OpenFace(filename);
+    if (handle == INVALID_FONT || !SelectFont(handle)) return false;
+
+    EvictFaces();
+    return true;
+}
+
+FontHandle GlyphExtractor::AcquireFont(const string &filename)
+{
+    FontHandle handle = OpenFace(filename);
+    if (handle != INVALID_FONT) {
+        ++m_faces[handle].references;
+        EvictFaces();
+    }
+    return handle;
+}
+
+void GlyphExtractor::ReleaseFont(FontHandle handle)
+{
+    auto it = m_faces.find(handle);
+    if (it == m_faces.end() || it->second.references == 0) {
+        cout << "GlyphExtractor ERROR: Released a font that was not acquired!" << endl;
+        return;
+    }
+
+    // the face stays resident so it can be reused, until it's evicted
+    --it->second.references;
+    EvictFaces();
+}
+
+bool GlyphExtractor::SelectFont(FontHandle handle)
+{
+    auto it = m_faces.find(handle);
+    if (it == m_faces.end()) {
+        cout << "GlyphExtractor ERROR: Invalid font handle " << handle << endl;
+        return false;
+    }
+
+    it->second.lastUsed = ++m_clock;
+    m_current = handle;
+    m_currentEntry = &it->second;
+    m_face = it->second.face;
+    return true;
+}
+
+void GlyphExtractor::SetMaxFaces(size_t maxFaces)
+{
+    m_maxFaces = maxFaces;
+    EvictFaces();
+}
+
+// --------------------------------------------------------------------------
+
+FontHandle GlyphExtractor::OpenFace(const string &filename)
+{
+    // reuse the face if this file has been opened before
+    auto found = m_handles.find(filename);
+    if (found != m_handles.end()) {
+        m_faces[found->second].lastUsed = ++m_clock;
+        return found->second;
+    }
+
+    if (!m_library) {
+        cout << "GlyphExtractor ERROR: FreeType is not initialized!" << endl;
+        return INVALID_FONT;
+    }
+
+    // parse the face from a mapping of the file if possible; the mapping
+    // has to outlive the face
+    FaceEntry entry;
+    entry.filename = filename;
+    entry.face = 0;
+    entry.fontHash = 0;
+    entry.cached = false;
+    entry.references = 0;
+    entry.arena = make_shared<GlyphArena>();
+    if (m_mapFiles) entry.mapping = MappedFile::Open(filename);
+
+    // with a valid glyph cache, FreeType isn't needed until a glyph is
+    // missing from it; the font is only read through if the cache can't
+    // tell from the file's size and time that it's still the same
+    if (entry.mapping) {
+        entry.cached = ReadGlyphCache(GlyphCachePath(filename), *entry.mapping, &entry.fontHash,
+                                      &entry.glyphs, &entry.kerning, entry.arena.get());
+    }
+    if (entry.cached)
+    {
+        for (const auto &glyph : entry.glyphs)
+            entry.cachedKerning.insert(glyph.first);
+    }
+    if (!entry.cached && !OpenFreeTypeFace(entry)) return INVALID_FONT;
+
+    FontHandle handle = m_nextHandle++;
+    entry.lastUsed = ++m_clock;
+    m_faces[handle] = std::move(entry);
+    m_handles[filename] = handle;
+
+    return handle;
+}
+
+bool GlyphExtractor::OpenFreeTypeFace(FaceEntry &entry)
+{
+    FT_Error error;
+    if (entry.mapping)
+        error = FT_New_Memory_Face(m_library, entry.mapping->Data(), entry.mapping->Size(), 0, &entry.face);
+    else
+        error = FT_New_Face(m_library, entry.filename.c_str(), 0, &entry.face);
 
     if (error == FT_Err_Unknown_File_Format) {
-        cout << "Freetype ERROR: unsupported file format in " << filename << endl;
+        cout << "Freetype ERROR: unsupported file format in " << entry.filename << endl;
+        entry.face = 0;
         return false;
     }
     else if (error) {
         cout << "FreeType ERROR: unknown error occurred." << endl;
+        entry.face = 0;
         return false;
     }
 
-    if (DEBUG_PRINT) PrintFontInformation();
+    if (DEBUG_PRINT) PrintFontInformation(entry.face);
 
     return true;
 }
 
+bool GlyphExtractor::WriteGlyphCache()
+{
+    if (!m_currentEntry || !m_currentEntry->mapping) return false;
+    if (m_currentEntry->cached) return true;
+
+    const MappedFile &mapping = *m_currentEntry->mapping;
+    if (!m_currentEntry->fontHash) {
+        m_currentEntry->fontHash = HashFontData(mapping.Data(), mapping.Size());
+    }
+
+    // every pair of the glyphs, so readers of the cache never look one up
+    const auto &glyphs = m_currentEntry->glyphs;
+    KerningTable kerning;
+    if (HasKerning())
+    {
+        for (const auto &left : glyphs)
+        {
+            for (const auto &right : glyphs)
+            {
+                float adjustment = Kerning(left.first, right.first);
+                if (adjustment != 0.f) kerning.pairs[KerningTable::Pair(left.first, right.first)] = adjustment;
+            }
+        }
+    }
+    m_currentEntry->cached = ::WriteGlyphCache(GlyphCachePath(m_currentEntry->filename), mapping,
+                                               m_currentEntry->fontHash, glyphs, kerning);
+    return m_currentEntry->cached;
+}
+
+void GlyphExtractor::EvictFaces()
+{
+    while (m_faces.size() > m_maxFaces)
+    {
+        // find the least recently used face that nobody is holding on to;
+        // the selected face is always kept open
+        auto oldest = m_faces.end();
+        for (auto it = m_faces.begin(); it != m_faces.end(); ++it)
+        {
+            if (it->second.references > 0 || it->first == m_current) continue;
+            if (oldest == m_faces.end() || it->second.lastUsed < oldest->second.lastUsed)
+                oldest = it;
+        }
+        if (oldest == m_faces.end()) return;
+
+        if (oldest->second.face) FT_Done_Face(oldest->second.face);
+        m_handles.erase(oldest->second.filename);
+        m_faces.erase(oldest);
+    }
+}
+
 // --------------------------------------------------------------------------
 
-void GlyphExtractor::PrintFontInformation() const
+void GlyphExtractor::PrintFontInformation(FT_Face face) const
 {
-    cout << "Font information for typeface " << m_face->family_name
-         << " (" << m_face->style_name << "):" << endl;
-    cout << "  Number of glyphs: \t" << m_face->num_glyphs << endl;
-    cout << "  Units per EM: \t" << m_face->units_per_EM << endl;
+    cout << "Font information for typeface " << face->family_name
+         << " (" << face->style_name << "):" << endl;
+    cout << "  Number of glyphs: \t" << face->num_glyphs << endl;
+    cout << "  Units per EM: \t" << face->units_per_EM << endl;
 }
 
 void GlyphExtractor::PrintGlyphInformation(int character) const
@@ -90,14 +436,99 @@ void GlyphExtractor::PrintGlyphInformation(int character) const
 
 // --------------------------------------------------------------------------
 
-MyGlyph GlyphExtractor::ExtractGlyph(int character) const
+GlyphCacheStats GlyphExtractor::CacheStats() const
 {
+    GlyphCacheStats stats = m_stats;
+    stats.glyphs = 0;
+    for (const auto &entry : m_faces)
+        stats.glyphs += entry.second.glyphs.size();
+    return stats;
+}
+
+const MyGlyph &GlyphExtractor::ExtractGlyph(int character)
+{
+    static const MyGlyph empty;
+
     // first check that a font has been loaded
-    if (!m_face) {
+    if (!m_currentEntry) {
+        cout << "GlyphExtractor ERROR: No font loaded!" << endl;
+        return empty;
+    }
+
+    auto &glyphs = m_currentEntry->glyphs;
+    auto cached = glyphs.find(character);
+    if (cached != glyphs.end()) {
+        ++m_stats.hits;
+        return cached->second;
+    }
+
+    // decode on first use; characters without an outline are cached empty
+    // so that they don't go back to FreeType either
+    ++m_stats.misses;
+    if (!m_currentEntry->face) {
+        if (!OpenFreeTypeFace(*m_currentEntry)) return empty;
+        m_face = m_currentEntry->face;
+    }
+    MyGlyph &glyph = glyphs[character];
+    DecodeGlyph(character, glyph);
+    return glyph;
+}
+
+bool GlyphExtractor::HasKerning()
+{
+    if (!m_currentEntry->face) {
+        if (!OpenFreeTypeFace(*m_currentEntry)) return false;
+        m_face = m_currentEntry->face;
+    }
+    return FT_HAS_KERNING(m_face);
+}
+
+float GlyphExtractor::Kerning(int left, int right)
+{
+    if (!m_currentEntry) {
         cout << "GlyphExtractor ERROR: No font loaded!" << endl;
-        return MyGlyph();
+        return 0.f;
     }
 
+    auto &pairs = m_currentEntry->kerning.pairs;
+    uint64_t pair = KerningTable::Pair(left, right);
+    auto cached = pairs.find(pair);
+    if (cached != pairs.end()) return cached->second;
+
+    const auto &cachedKerning = m_currentEntry->cachedKerning;
+    if (cachedKerning.count(left) && cachedKerning.count(right)) return 0.f;
+
+    float adjustment = FaceKerning(left, right);
+    pairs[pair] = adjustment;
+    return adjustment;
+}
+
+float GlyphExtractor::FaceKerning(int left, int right)
+{
+    if (!HasKerning()) return 0.f;
+
+    FT_Vector delta;
+    FT_Error error = FT_Get_Kerning(m_face, FT_Get_Char_Index(m_face, left),
+                                    FT_Get_Char_Index(m_face, right), FT_KERNING_UNSCALED, &delta);
+    return error ? 0.f : delta.x / float(m_face->units_per_EM);
+}
+
+void GlyphExtractor::BuildKerning(const vector<int> &characters, KerningTable *table)
+{
+    if (!m_currentEntry) return;
+
+    for (int left : characters)
+    {
+        for (int right : characters)
+        {
+            float adjustment = Kerning(left, right);
+            if (adjustment != 0.f) table->pairs[KerningTable::Pair(left, right)] = adjustment;
+        }
+    }
+}
+
+bool GlyphExtractor::DecodeGlyph(int character, MyGlyph &glyph)
+{
     // look up the glyph index for the given character code
     int index = FT_Get_Char_Index(m_face, character);
 
@@ -108,23 +539,28 @@ MyGlyph GlyphExtractor::ExtractGlyph(int character) const
     {
         cout << "FreeType ERROR: Could not find glyph outline for character "
              << character << " (" << char(character) << ")" <<  endl;
-        return MyGlyph();
+        return false;
     }
 
     if (DEBUG_PRINT) PrintGlyphInformation(character);
 
-    // create a new glyph structure to populate with this character outline
+    // populate the glyph structure with this character outline
     FT_Outline &outline = m_face->glyph->outline;
     float em = m_face->units_per_EM;
-    MyGlyph glyph(m_face->glyph->advance.x / em);
+    glyph.advance = m_face->glyph->advance.x / em;
 
     // current point index
     int begin = 0;
 
+    m_pointTable.clear();
+    m_segmentTable.clear();
+    m_contourTable.clear();
+
     // iterate through the outline's contours
     for (int c = 0; c < outline.n_contours; ++c)
     {
         MyContour contour;
+        contour.first = m_segmentTable.size();
 
         // iterate through current contour's points
         int end = outline.contours[c];
@@ -195,18 +631,35 @@ MyGlyph GlyphExtractor::ExtractGlyph(int character) const
                 }
             }
 
-            // add segment to contour
-            contour.push_back(segment);
+            // add segment to contour; its start point is the previous
+            // segment's end point, except at the start of the contour
+            if (m_segmentTable.size() == contour.first) {
+                MyPoint start = { segment.x[0], segment.y[0] };
+                m_pointTable.push_back(start);
+            }
+
+            MySegmentEntry entry;
+            entry.degree = segment.degree;
+            entry.offset = m_pointTable.size() - 1;
+            m_segmentTable.push_back(entry);
+
+            for (unsigned int i = 1; i <= segment.degree; ++i) {
+                MyPoint point = { segment.x[i], segment.y[i] };
+                m_pointTable.push_back(point);
+            }
         }
 
         // set beginning of next contour
         begin = end + 1;
 
         // add contour to glyph
-        glyph.contours.push_back(contour);
+        contour.count = m_segmentTable.size() - contour.first;
+        m_contourTable.push_back(contour);
     }
 
-    return glyph;
+    glyph.Pack(m_pointTable, m_segmentTable, m_contourTable, m_currentEntry->arena.get());
+
+    return true;
 }
 
 // --------------------------------------------------------------------------
@@ -6,9 +6,13 @@
 // well as a GlyphExtractor class that will retrieve glyph outlines from a
 // font file for specified characters. Data structures are as follows:
 //  - A glyph consists of zero or more contours, plus an advance width
-//  - A contour consists of one or more segments (stored as std::vector)
+//  - A contour consists of one or more segments (a range of the segment table)
 //  - A segment is either a straight line, quadratic Bezier, or cubic Bezier
 //
+// A glyph's points, segment table and contour table are packed together in
+// a single allocation, or in a GlyphArena shared with other glyphs; segments
+// in a contour share their end points.
+//
 // You may use this code (or not) however you see fit for your work.
 //
 // Author:  Sonny Chan
@@ -18,8 +22,14 @@
 #ifndef GLYPHEXTRACTOR_H
 #define GLYPHEXTRACTOR_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "MappedFile.h"
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -28,7 +38,8 @@
 // DATA STRUCTURES: Segment, Contour, and Glyph
 
 // A segment encodes a point, a straight line segment, a quadratic Bezier curve,
-// or a cubic Bezier curve, as indicated by its degree field.
+// or a cubic Bezier curve, as indicated by its degree field. Glyphs don't
+// store these; MyGlyph::Segment() expands one from the packed tables.
 struct MySegment
 {
     // degree of Bezier curve segment (0=point, 1=line, 2=quadratic, 3=cubic)
@@ -41,8 +52,61 @@ struct MySegment
     {}
 };
 
-// An contour is a Bezier spline: a sequence of curve segments that share endpoints.
-typedef std::vector<MySegment> MyContour;
+// A control point of a glyph outline, in EM-box coordinates.
+struct MyPoint
+{
+    float x, y;
+};
+
+// Segment table entry: the control points of a segment are the glyph's
+// points [offset] through [offset + degree].
+struct MySegmentEntry
+{
+    unsigned int degree;
+    unsigned int offset;
+};
+
+// An contour is a Bezier spline: a sequence of curve segments that share
+// endpoints, stored as the segment table range [first, first + count).
+struct MyContour
+{
+    unsigned int first;
+    unsigned int count;
+};
+
+// A box in EM-box coordinates, e.g. around all the control points of a glyph;
+// Bezier curves lie inside the hull of their control points, so the outline
+// does too.
+struct MyBounds
+{
+    float xMin, yMin;
+    float xMax, yMax;
+};
+
+// Blocks of memory that the tables of many glyphs are packed into one after
+// another, so a whole font's outlines take a handful of allocations instead
+// of one per glyph. Nothing is freed until the arena is, and blocks never
+// move, so tables stay valid for as long as the arena.
+class GlyphArena
+{
+    std::vector<std::unique_ptr<unsigned char[]> > m_blocks;
+    size_t  m_used;         // bytes handed out from the last block
+    size_t  m_capacity;     // size of the last block
+
+public:
+    GlyphArena();
+
+    GlyphArena(const GlyphArena &) = delete;
+    GlyphArena &operator=(const GlyphArena &) = delete;
+
+    // makes sure the next allocations totalling bytes fit without another block
+    void Reserve(size_t bytes);
+
+    // bytes of 4-byte aligned storage
+    void *Allocate(size_t bytes);
+
+    size_t BlockCount() const { return m_blocks.size(); }
+};
 
 // A glyph consists of a set of contours and an advance width to the next glyph.
 struct MyGlyph
@@ -50,34 +114,227 @@ struct MyGlyph
     // advance width to next glyph, in EM units
     float advance;
 
-    // contours that form this glyph, in EM-box coordinates
-    std::vector<MyContour> contours;
+    // box around the outline, found when it's packed; all zero if it's empty
+    MyBounds bounds;
+
+    // packed outline of this glyph, in EM-box coordinates
+    unsigned int            pointCount;
+    unsigned int            segmentCount;
+    unsigned int            contourCount;
+    const MyPoint          *points;
+    const MySegmentEntry   *segments;
+    const MyContour        *contours;
+
+    MyGlyph(float adv = 0);
+    MyGlyph(const MyGlyph &other);
+    MyGlyph &operator=(const MyGlyph &other);
+
+    // copies the given tables into this glyph's single block of storage, or
+    // into the arena if there is one, so that copies of the glyph share them
+    void Pack(const std::vector<MyPoint> &pointTable,
+              const std::vector<MySegmentEntry> &segmentTable,
+              const std::vector<MyContour> &contourTable, GlyphArena *arena = 0);
+    void Pack(const MyPoint *pointTable, unsigned int points,
+              const MySegmentEntry *segmentTable, unsigned int segments,
+              const MyContour *contourTable, unsigned int contours, GlyphArena *arena = 0);
+
+    // expands a segment table entry to its control point coordinates
+    MySegment Segment(unsigned int index) const;
+
+    // size of the packed tables, e.g. to reserve an arena for many glyphs
+    size_t TableBytes() const;
+
+    // copies this glyph with its tables packed into the arena instead of
+    // storage of its own; copies of the result share those tables, and
+    // are valid as long as the arena is
+    MyGlyph CopyTo(GlyphArena *arena) const;
+
+private:
+    // the packed tables, unless they are in an arena
+    std::vector<unsigned char> m_storage;
+
+    // points the table pointers into m_storage
+    void Link();
+};
+
+// Kerning of a face: what is added to the advance of a character when the
+// given one follows it, in EM units. Pairs that aren't stored have none.
+struct KerningTable
+{
+    std::unordered_map<uint64_t, float> pairs;
+
+    static uint64_t Pair(int left, int right)
+    {
+        return (uint64_t(uint32_t(left)) << 32) | uint32_t(right);
+    }
+
+    float Adjustment(int left, int right) const
+    {
+        auto found = pairs.find(Pair(left, right));
+        return found == pairs.end() ? 0.f : found->second;
+    }
+};
+
+// --------------------------------------------------------------------------
+// Handle to a font face held open by a GlyphExtractor. Handles stay valid
+// until the last reference is released and the face is evicted.
+
+typedef int FontHandle;
+const FontHandle INVALID_FONT = -1;
+
+// Counters for the decoded glyph cache, to help size it.
+struct GlyphCacheStats
+{
+    unsigned long   hits;
+    unsigned long   misses;
+    size_t          glyphs;     // outlines currently held, across all faces
 
-    MyGlyph(float adv = 0) : advance(adv)
+    GlyphCacheStats() : hits(0), misses(0), glyphs(0)
     {}
 };
 
 // --------------------------------------------------------------------------
 // This class encapsulates functionality required to load a font file from
 // disk and retrieve glyph outlines for characters from the font.
+//
+// Faces are opened once per file and kept in a registry keyed by path, so
+// selecting a font that was used before never touches the disk again. Faces
+// with no outstanding references are evicted least-recently-used first once
+// more than the configured maximum are open. Each face also keeps the glyphs
+// decoded from it, so a character is only converted from FreeType once.
+//
+// Font files are memory mapped where possible, so faces are parsed from the
+// page cache, and extractors in other threads share the same pages. Mapped
+// fonts can also have a glyph cache file saved next to them (GlyphCache.h);
+// when it's valid, glyphs come from there, and FreeType only opens the face
+// if a glyph is asked for that the cache doesn't have.
 
 class GlyphExtractor
 {
+    // a face opened from a font file, plus its bookkeeping for the registry
+    struct FaceEntry
+    {
+        std::string     filename;
+        FT_Face         face;   // null until a glyph isn't in the cache
+        std::shared_ptr<const MappedFile> mapping;  // backs the face, if mapped
+        uint64_t        fontHash;   // of the mapped file, 0 until it's needed
+        bool            cached;     // glyphs came from, or went to, the cache
+        int             references;
+        unsigned long   lastUsed;
+
+        // outlines already extracted from this face, by character code, with
+        // their tables in the arena, which copies of them can keep alive
+        std::unordered_map<int, MyGlyph> glyphs;
+        std::shared_ptr<GlyphArena> arena;
+
+        // pairs already looked up, including those without kerning
+        KerningTable    kerning;
+
+        // characters whose pairs all came from the glyph cache; those not
+        // in kerning have none, without asking FreeType
+        std::unordered_set<int> cachedKerning;
+    };
+
     FT_Library  m_library;
     FT_Face     m_face;
+    FontHandle  m_current;
+    FaceEntry  *m_currentEntry;
+
+    // open faces by handle, and handles by file name
+    std::unordered_map<FontHandle, FaceEntry>   m_faces;
+    std::unordered_map<std::string, FontHandle> m_handles;
+    FontHandle      m_nextHandle;
+    unsigned long   m_clock;
+    size_t          m_maxFaces;
+    bool            m_mapFiles;
+    GlyphCacheStats m_stats;
+
+    // opens the named face if it isn't already resident, returning its handle;
+    // callers select or reference the face before evicting
+    FontHandle OpenFace(const std::string &filename);
+
+    // opens the FreeType face of an entry, returning false if it can't
+    bool OpenFreeTypeFace(FaceEntry &entry);
+
+    // converts the outline for a character from the selected face
+    bool DecodeGlyph(int character, MyGlyph &glyph);
+
+    // opens the FreeType face of the selected entry if it isn't yet,
+    // returning whether it has a 'kern' table
+    bool HasKerning();
+
+    // looks a pair up in the selected face's 'kern' table, opening it
+    float FaceKerning(int left, int right);
+
+    // scratch tables reused by DecodeGlyph() before packing
+    std::vector<MyPoint>        m_pointTable;
+    std::vector<MySegmentEntry> m_segmentTable;
+    std::vector<MyContour>      m_contourTable;
+
+    // closes unreferenced faces, oldest first, until at most m_maxFaces remain
+    void EvictFaces();
 
     // private methods to print font/glyph info, for debugging
-    void PrintFontInformation() const;
+    void PrintFontInformation(FT_Face face) const;
     void PrintGlyphInformation(int character) const;
 
 public:
-    GlyphExtractor();
+    GlyphExtractor(size_t maxFaces = 8);
+    ~GlyphExtractor();
 
-    // call this method first to load a font file
+    GlyphExtractor(const GlyphExtractor &) = delete;
+    GlyphExtractor &operator=(const GlyphExtractor &) = delete;
+
+    // call this method first to load a font file; the face is cached, so
+    // calling it again with the same file only reselects it
     bool LoadFontFile(const std::string &filename);
 
-    // this method retrieves a (possibly composite) glyph for the given character
-    MyGlyph ExtractGlyph(int character) const;
+    // opens (or reuses) a face and holds a reference to it until released
+    FontHandle AcquireFont(const std::string &filename);
+    void ReleaseFont(FontHandle handle);
+
+    // makes a previously acquired face the one glyphs are extracted from
+    bool SelectFont(FontHandle handle);
+
+    // limits the number of faces kept open; referenced faces are never evicted
+    void SetMaxFaces(size_t maxFaces);
+    size_t FaceCount() const { return m_faces.size(); }
+
+    // whether faces opened from now on are memory mapped (the default), or
+    // read through FreeType's own file access
+    void SetMapFiles(bool mapFiles) { m_mapFiles = mapFiles; }
+
+    // this method retrieves a (possibly composite) glyph for the given
+    // character; the reference stays valid as long as the face is open
+    const MyGlyph &ExtractGlyph(int character);
+
+    // holds the outlines of the selected face's glyphs; copies of them stay
+    // valid as long as it does, even once the face is closed
+    std::shared_ptr<const GlyphArena> GlyphStorage() const
+    {
+        return m_currentEntry ? m_currentEntry->arena : std::shared_ptr<const GlyphArena>();
+    }
+
+    // the kerning between two characters of the selected face, from the
+    // face's 'kern' table; each pair is only looked up in FreeType once,
+    // and pairs of glyphs from their cache never are. FreeType only reads
+    // 'kern' tables, not the kerning in 'GPOS' tables, so fonts that only
+    // have the latter, like the CFF Source Sans, come out unkerned.
+    float Kerning(int left, int right);
+
+    // adds every kerned pair of the given characters to table, e.g. to lay
+    // out text in them without the extractor
+    void BuildKerning(const std::vector<int> &characters, KerningTable *table);
+
+    // saves the glyphs decoded from the selected face so far as its glyph
+    // cache, along with the kerning between them, unless it has a valid one
+    // already; only mapped fonts have one
+    bool WriteGlyphCache();
+    bool HasGlyphCache() const { return m_currentEntry && m_currentEntry->cached; }
+
+    // cache hit/miss counters, and a way to start counting afresh
+    GlyphCacheStats CacheStats() const;
+    void ResetCacheStats() { m_stats = GlyphCacheStats(); }
 };
 
 // --------------------------------------------------------------------------
@@ -0,0 +1,198 @@
+// ==========================================================================
+// Parallel Glyph Extraction Service
+//
+// Worker threads are started for each batch of jobs and joined before Run()
+// returns, while the extractors outlive them; faces and decoded glyphs stay
+// cached from one batch to the next, so only the first batch to use a font
+// pays for opening it on each worker.
+//
+// Kerning pairs are looked up through the same extractors, so they are
+// remembered per worker and face as well.
+// ==========================================================================
+
+#include "GlyphService.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+void DecodeUTF8(string_view text, vector<int> *characters)
+{
+    characters->clear();
+    characters->reserve(text.size());
+    for (size_t i = 0; i < text.size();)
+    {
+        // the lead byte gives the length of the sequence, and its first bits
+        unsigned char lead = text[i];
+        size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x06 ? 2 :
+                        (lead >> 4) == 0x0E ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+        int character = length == 1 ? lead : lead & (0x7F >> length);
+
+        bool valid = length > 0 && i + length <= text.size();
+        for (size_t k = 1; valid && k < length; ++k)
+        {
+            unsigned char next = text[i + k];
+            valid = (next & 0xC0) == 0x80;
+            character = (character << 6) | (next & 0x3F);
+        }
+
+        // overlong encodings and surrogates aren't characters either
+        static const int smallest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        valid = valid && character >= smallest[length] && character <= 0x10FFFF &&
+                (character < 0xD800 || character > 0xDFFF);
+
+        if (!valid)
+        {
+            characters->push_back(REPLACEMENT_CHARACTER);
+            ++i;
+            continue;
+        }
+        characters->push_back(character);
+        i += length;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+GlyphService::GlyphService(unsigned int workers)
+{
+    if (workers == 0) workers = thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+
+    for (unsigned int i = 0; i < workers; ++i)
+        m_extractors.push_back(unique_ptr<GlyphExtractor>(new GlyphExtractor()));
+}
+
+// --------------------------------------------------------------------------
+
+void GlyphService::RunJob(GlyphExtractor &extractor, const string &fontFile,
+                          string_view text, GlyphRun *target)
+{
+    GlyphRun &run = *target;
+    DecodeUTF8(text, &run.characters);
+    run.glyphs.clear();
+    run.pens.clear();
+    run.advance = 0.f;
+    run.font.reset();
+
+    run.loaded = extractor.LoadFontFile(fontFile);
+    if (!run.loaded)
+    {
+        run.characters.clear();
+        run.arena.reset();
+        return;
+    }
+    run.arena = extractor.GlyphStorage();
+
+    run.glyphs.reserve(run.characters.size());
+    run.pens.reserve(run.characters.size());
+    for (size_t i = 0; i < run.characters.size(); ++i)
+    {
+        if (i > 0) run.advance += extractor.Kerning(run.characters[i - 1], run.characters[i]);
+
+        run.glyphs.push_back(extractor.ExtractGlyph(run.characters[i]));
+        run.pens.push_back(run.advance);
+        run.advance += run.glyphs.back().advance;
+    }
+}
+
+void GlyphService::RunJob(GlyphExtractor &extractor, const GlyphJob &job)
+{
+    RunJob(extractor, job.fontFile, job.text, job.run);
+    if (!job.kerning || !job.run->loaded) return;
+
+    extractor.BuildKerning(job.run->characters, job.kerning);
+    if (!extractor.HasGlyphCache())
+        extractor.WriteGlyphCache();
+}
+
+void GlyphService::SetMapFiles(bool mapFiles)
+{
+    for (unique_ptr<GlyphExtractor> &extractor : m_extractors)
+        extractor->SetMapFiles(mapFiles);
+}
+
+void GlyphService::Run(const vector<GlyphJob> &jobs)
+{
+    size_t workers = min(jobs.size(), m_extractors.size());
+    if (workers <= 1)
+    {
+        for (const GlyphJob &job : jobs)
+            RunJob(*m_extractors[0], job);
+        return;
+    }
+
+    // each worker claims the next job not yet taken until none are left
+    atomic<size_t> next(0);
+    vector<thread> threads;
+    threads.reserve(workers);
+    for (size_t i = 0; i < workers; ++i)
+    {
+        GlyphExtractor &extractor = *m_extractors[i];
+        threads.push_back(thread([&jobs, &next, &extractor]() {
+            for (size_t j = next++; j < jobs.size(); j = next++)
+                RunJob(extractor, jobs[j]);
+        }));
+    }
+
+    for (thread &worker : threads)
+        worker.join();
+}
+
+bool GlyphService::Decode(const string &fontFile, string_view text, GlyphRun *run)
+{
+    RunJob(*m_extractors[0], fontFile, text, run);
+    return run->loaded;
+}
+
+// --------------------------------------------------------------------------
+
+ShapedRunCache::ShapedRunCache(size_t maxRuns)
+    : m_clock(0), m_maxRuns(maxRuns), m_hits(0), m_misses(0)
+{}
+
+const string &ShapedRunCache::Key(const string &fontFile, string_view text)
+{
+    // file names never contain a null, so the key can't be ambiguous
+    m_key.assign(fontFile);
+    m_key.push_back('\0');
+    m_key.append(text.data(), text.size());
+    return m_key;
+}
+
+shared_ptr<const GlyphRun> ShapedRunCache::Find(const string &fontFile, string_view text)
+{
+    auto found = m_runs.find(Key(fontFile, text));
+    if (found == m_runs.end())
+    {
+        ++m_misses;
+        return shared_ptr<const GlyphRun>();
+    }
+
+    ++m_hits;
+    found->second.lastUsed = ++m_clock;
+    return found->second.run;
+}
+
+void ShapedRunCache::Insert(const string &fontFile, string_view text, shared_ptr<const GlyphRun> run)
+{
+    // make room by dropping the run used longest ago
+    if (m_runs.size() >= m_maxRuns && m_runs.find(Key(fontFile, text)) == m_runs.end())
+    {
+        auto oldest = m_runs.begin();
+        for (auto it = m_runs.begin(); it != m_runs.end(); ++it)
+        {
+            if (it->second.lastUsed < oldest->second.lastUsed) oldest = it;
+        }
+        if (oldest != m_runs.end()) m_runs.erase(oldest);
+    }
+
+    Entry entry = { run, ++m_clock };
+    m_runs[Key(fontFile, text)] = entry;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,150 @@
+// ==========================================================================
+// Parallel Glyph Extraction Service
+//
+// A GlyphExtractor drives a single FreeType library through one face glyph
+// slot at a time, so it can only be used by one thread. This module keeps
+// one extractor (with its own FT_Library and faces) per worker, and runs
+// jobs that each decode and lay out one string in one font. Jobs are handed
+// out to the workers as they finish earlier ones, so a batch of strings in
+// mixed fonts decodes on all cores instead of one face after another.
+//
+// Strings are UTF-8, and runs are kerned from each face's 'kern' table.
+// Runs that were laid out once can be kept in a ShapedRunCache, so text
+// that is drawn again (labels, counters) isn't laid out again.
+// ==========================================================================
+#ifndef GLYPHSERVICE_H
+#define GLYPHSERVICE_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "GlyphExtractor.h"
+
+// --------------------------------------------------------------------------
+// A decoded and laid out string: the code point of every character and a
+// copy of its glyph, each placed at a pen position along the baseline, in
+// EM units
+
+struct LoadedFont;
+
+struct GlyphRun
+{
+    std::vector<int>        characters;
+    std::vector<MyGlyph>    glyphs;
+    std::vector<float>      pens;
+    float                   advance;    // where the next character would go
+
+    // the font file could be opened; the run is empty otherwise
+    bool                    loaded;
+
+    // the loaded font whose arena holds the glyphs' outlines, or else the
+    // arena of the extractor face they were decoded from, kept alive as
+    // long as the run
+    std::shared_ptr<const LoadedFont> font;
+    std::shared_ptr<const GlyphArena> arena;
+
+    GlyphRun() : advance(0.f), loaded(false)
+    {}
+};
+
+// code point used for bytes that aren't valid UTF-8
+const int REPLACEMENT_CHARACTER = 0xFFFD;
+
+// replaces characters with the code points of a UTF-8 string
+void DecodeUTF8(std::string_view text, std::vector<int> *characters);
+
+// A string to decode in a font, and the caller's run to write it to. The
+// run must stay alive, and untouched, until the job has been run. A job
+// with a kerning table also fills it with every kerned pair of the string's
+// characters, and saves the font's glyph cache if it had none, so a font
+// decoded from a character set can be laid out without FreeType.
+struct GlyphJob
+{
+    std::string     fontFile;
+    std::string     text;
+    GlyphRun       *run;
+    KerningTable   *kerning;
+};
+
+// --------------------------------------------------------------------------
+
+class GlyphService
+{
+    // one extractor per worker; worker i only ever uses m_extractors[i], so
+    // none of them is shared between threads
+    std::vector<std::unique_ptr<GlyphExtractor> > m_extractors;
+
+    // decodes a string with the given worker's extractor; the glyphs are
+    // copied without their outlines, so once the extractor has seen the
+    // characters and the run has grown to them, nothing is allocated
+    static void RunJob(GlyphExtractor &extractor, const std::string &fontFile,
+                       std::string_view text, GlyphRun *run);
+
+    // runs a job with the given worker's extractor, kerning included
+    static void RunJob(GlyphExtractor &extractor, const GlyphJob &job);
+
+public:
+    // workers defaults to the number of hardware threads
+    GlyphService(unsigned int workers = 0);
+
+    GlyphService(const GlyphService &) = delete;
+    GlyphService &operator=(const GlyphService &) = delete;
+
+    unsigned int WorkerCount() const { return m_extractors.size(); }
+
+    // whether the workers map faces opened from now on, as the extractor does
+    void SetMapFiles(bool mapFiles);
+
+    // runs all the jobs, spread across the workers, and returns once every
+    // run has been written; a single job runs on the calling thread. Only
+    // one thread may call this at a time.
+    void Run(const std::vector<GlyphJob> &jobs);
+
+    // decodes a single string, on the calling thread
+    bool Decode(const std::string &fontFile, std::string_view text, GlyphRun *run);
+};
+
+// --------------------------------------------------------------------------
+// Runs already laid out, by font file and string. Runs are immutable once
+// added, so they can be shared by everything drawing the same string; the
+// least recently used one is dropped once more than the maximum are kept.
+// Layouts are in EM units, so a run is the same at any text size.
+
+class ShapedRunCache
+{
+    struct Entry
+    {
+        std::shared_ptr<const GlyphRun> run;
+        unsigned long   lastUsed;
+    };
+
+    std::unordered_map<std::string, Entry> m_runs;
+    std::string     m_key;      // scratch key, reused by every lookup
+    unsigned long   m_clock;
+    size_t          m_maxRuns;
+    unsigned long   m_hits;
+    unsigned long   m_misses;
+
+    // builds the key of a font and string in m_key
+    const std::string &Key(const std::string &fontFile, std::string_view text);
+
+public:
+    ShapedRunCache(size_t maxRuns = 256);
+
+    // returns the run of the string in the font, or null if there isn't one
+    std::shared_ptr<const GlyphRun> Find(const std::string &fontFile, std::string_view text);
+
+    // keeps the run of the string in the font, replacing any earlier one
+    void Insert(const std::string &fontFile, std::string_view text,
+                std::shared_ptr<const GlyphRun> run);
+
+    size_t RunCount() const { return m_runs.size(); }
+    unsigned long Hits() const { return m_hits; }
+    unsigned long Misses() const { return m_misses; }
+};
+
+// --------------------------------------------------------------------------
+#endif // GLYPHSERVICE_H
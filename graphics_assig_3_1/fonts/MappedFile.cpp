@@ -0,0 +1,83 @@
+// ==========================================================================
+// Read-Only Memory Mapped Files
+//
+// Uses POSIX mmap; on other platforms Open() always fails, and callers fall
+// back to reading the file themselves.
+// ==========================================================================
+
+#include "MappedFile.h"
+#include <map>
+#include <mutex>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPEDFILE_POSIX 1
+#endif
+
+using namespace std;
+
+// mappings currently alive, by path, so they can be shared
+static mutex s_registryMutex;
+static map<string, weak_ptr<const MappedFile> > s_registry;
+
+// --------------------------------------------------------------------------
+
+MappedFile::MappedFile(const string &path)
+    : m_path(path), m_data(0), m_size(0), m_modified(0), m_fileId(0)
+{
+#if MAPPEDFILE_POSIX
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return;
+
+    struct stat status;
+    if (fstat(file, &status) == 0 && status.st_size > 0)
+    {
+        void *data = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data != MAP_FAILED)
+        {
+            m_data = static_cast<const unsigned char *>(data);
+            m_size = status.st_size;
+        }
+
+#if defined(__APPLE__)
+        m_modified = uint64_t(status.st_mtimespec.tv_sec) * 1000000000ull + status.st_mtimespec.tv_nsec;
+#else
+        m_modified = uint64_t(status.st_mtim.tv_sec) * 1000000000ull + status.st_mtim.tv_nsec;
+#endif
+        m_fileId = status.st_ino;
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(file);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#if MAPPEDFILE_POSIX
+    if (m_data) munmap(const_cast<unsigned char *>(m_data), m_size);
+#endif
+}
+
+shared_ptr<const MappedFile> MappedFile::Open(const string &path)
+{
+    lock_guard<mutex> lock(s_registryMutex);
+
+    shared_ptr<const MappedFile> mapping = s_registry[path].lock();
+    if (mapping) return mapping;
+
+    shared_ptr<MappedFile> opened(new MappedFile(path));
+    if (!opened->m_data)
+    {
+        s_registry.erase(path);
+        return shared_ptr<const MappedFile>();
+    }
+
+    s_registry[path] = opened;
+    return opened;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,50 @@
+// ==========================================================================
+// Read-Only Memory Mapped Files
+//
+// Font files are mapped rather than read, so FreeType parses them straight
+// from the page cache. A mapping is shared by everything in the process
+// that opens the same path, e.g. the extractors of different threads, and
+// is unmapped when the last of them lets go of it.
+// ==========================================================================
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// --------------------------------------------------------------------------
+
+class MappedFile
+{
+    std::string     m_path;
+    const unsigned char *m_data;
+    size_t          m_size;
+    uint64_t        m_modified;     // modification time, in nanoseconds
+    uint64_t        m_fileId;       // inode number
+
+    explicit MappedFile(const std::string &path);
+
+public:
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // maps the file, or returns its existing mapping; returns null if the
+    // file can't be mapped (or mapping isn't supported on this platform)
+    static std::shared_ptr<const MappedFile> Open(const std::string &path);
+
+    const unsigned char *Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+    const std::string &Path() const { return m_path; }
+
+    // the file as it was when mapped, to tell whether it's still the same
+    // file without reading it
+    uint64_t ModifiedTime() const { return m_modified; }
+    uint64_t FileId() const { return m_fileId; }
+};
+
+// --------------------------------------------------------------------------
+#endif // MAPPEDFILE_H
@@ -0,0 +1,706 @@
+#include "geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace std;
+using namespace glm;
+
+bool CheckGLErrors();
+
+// attribute indices, matching the layout locations in the vertex shaders
+static const GLuint VERTEX_INDEX = 0;
+static const GLuint COLOUR_INDEX = 1;
+static const GLuint PLACEMENT_INDEX = 2;
+static const GLuint TAG_INDEX = 3;
+static const GLuint TEXTURE_INDEX = 4;
+
+// smallest ring region allocated for streaming geometry, in elements
+static const GLsizei MIN_STREAM_CAPACITY = 1024;
+
+// running total reported by GeometryBytesUploaded()
+static size_t bytesUploaded = 0;
+
+Geometry::Geometry()
+    : vertexBuffer(0), textureBuffer(0), colourBuffer(0), tagBuffer(0),
+      vertexArray(0), firstElement(0), elementCount(0), format(COLOURED_VERTICES),
+      positionScale(1.f), colour(1.f, 1.f, 1.f), tagged(false), patchDegree(0), instanceBuffer(0),
+      streaming(false), persistent(false), streamCapacity(0), streamRegion(0),
+      vertexMapping(0), colourMapping(0), tagMapping(0)
+{
+    for (int i = 0; i < STREAM_REGIONS; i++)
+        streamFences[i] = 0;
+}
+
+// bytes per vertex in the vertex buffer, and in the colour buffer
+static GLsizei VertexStride(VertexFormat format)
+{
+    switch (format) {
+        case HALF_POSITIONS:
+        case SNORM16_POSITIONS:
+            return 2 * sizeof(GLshort);
+        default:
+            return sizeof(vec2);
+    }
+}
+
+static GLsizei ColourStride(VertexFormat format)
+{
+    return (format == COLOURED_VERTICES) ? sizeof(vec3) : 0;
+}
+
+// points the vertex array object's attributes at the geometry's buffers
+static void BindAttributes(Geometry *geometry)
+{
+    glBindVertexArray(geometry->vertexArray);
+
+    GLenum type = GL_FLOAT;
+    GLboolean normalized = GL_FALSE;
+    if (geometry->format == HALF_POSITIONS) {
+        type = GL_HALF_FLOAT;
+    } else if (geometry->format == SNORM16_POSITIONS) {
+        type = GL_SHORT;
+        normalized = GL_TRUE;
+    }
+
+    // associate the position array with the vertex array object
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+    glVertexAttribPointer(
+                          VERTEX_INDEX,         //Attribute index
+                          2,                    //# of components
+                          type,                 //Type of component
+                          normalized,           //Should be normalized?
+                          VertexStride(geometry->format), //Stride
+                          0);                   //Offset to first element
+    glEnableVertexAttribArray(VERTEX_INDEX);
+
+    // associate the colour array with the vertex array object; compact
+    // geometry leaves it disabled, so the shader sees a constant colour,
+    // unless it is instanced and takes colours from its instances
+    if (geometry->instanceBuffer) {
+        // the instance arrays are pointed at each batch as it is drawn
+        glVertexAttribDivisor(COLOUR_INDEX, 1);
+        glVertexAttribDivisor(PLACEMENT_INDEX, 1);
+        glEnableVertexAttribArray(COLOUR_INDEX);
+        glEnableVertexAttribArray(PLACEMENT_INDEX);
+    } else if (geometry->format == COLOURED_VERTICES) {
+        glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+        glVertexAttribPointer(
+                              COLOUR_INDEX,         //Attribute index
+                              3,                    //# of components
+                              GL_FLOAT,             //Type of component
+                              GL_FALSE,             //Should be normalized?
+                              0,                    //Stride - can use 0 if tightly packed
+                              0);                   //Offset to first element
+        glEnableVertexAttribArray(COLOUR_INDEX);
+    } else {
+        glDisableVertexAttribArray(COLOUR_INDEX);
+    }
+
+    // associate the vertex tags with the vertex array object
+    if (geometry->tagged) {
+        glBindBuffer(GL_ARRAY_BUFFER, geometry->tagBuffer);
+        glVertexAttribIPointer(TAG_INDEX, 1, GL_UNSIGNED_BYTE, 0, 0);
+        glEnableVertexAttribArray(TAG_INDEX);
+    } else {
+        glDisableVertexAttribArray(TAG_INDEX);
+    }
+
+    // and the texture coordinates, for geometry that has them
+    if (geometry->textureBuffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, geometry->textureBuffer);
+        glVertexAttribPointer(TEXTURE_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(TEXTURE_INDEX);
+    } else {
+        glDisableVertexAttribArray(TEXTURE_INDEX);
+    }
+
+    // unbind our buffers, resetting to default state
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+bool InitializeVAO(Geometry *geometry, VertexFormat format, bool streaming)
+{
+    glEnable(GL_PROGRAM_POINT_SIZE);
+
+    // streaming buffers are created on the first upload, once their size is
+    // known; persistent mapping needs immutable storage from ARB_buffer_storage
+    geometry->format = format;
+    geometry->streaming = streaming;
+    geometry->persistent = streaming && GLAD_GL_ARB_buffer_storage && glBufferStorage;
+
+    //Generate Vertex Buffer Objects
+    // create an array buffer object for storing our vertices
+    glGenBuffers(1, &geometry->vertexBuffer);
+
+    // create another one for storing our colours
+    if (format == COLOURED_VERTICES) {
+        glGenBuffers(1, &geometry->colourBuffer);
+    }
+
+    // and one for the tags of vertices, such as the degrees of patches
+    glGenBuffers(1, &geometry->tagBuffer);
+
+    //Set up Vertex Array Object
+    // create a vertex array object encapsulating all our vertex attributes
+    glGenVertexArrays(1, &geometry->vertexArray);
+    BindAttributes(geometry);
+
+    return !CheckGLErrors();
+}
+
+// converts positions to the geometry's vertex format, returning the bytes
+// to upload; float positions are used as they are
+static const void *EncodePositions(Geometry *geometry, const vector<vec2> &points)
+{
+    geometry->positionScale = 1.f;
+    if (geometry->format == COLOURED_VERTICES || geometry->format == FLOAT_POSITIONS) {
+        return points.data();
+    }
+
+    geometry->encoded.resize(points.size() * VertexStride(geometry->format));
+    uint32_t *packed = reinterpret_cast<uint32_t *>(geometry->encoded.data());
+
+    if (geometry->format == HALF_POSITIONS) {
+        for (size_t i = 0; i < points.size(); i++)
+            packed[i] = packHalf2x16(points[i]);
+    } else {
+        // normalize into [-1, 1] by the largest coordinate magnitude
+        float extent = 0.f;
+        for (size_t i = 0; i < points.size(); i++)
+            extent = std::max(extent, std::max(std::fabs(points[i].x), std::fabs(points[i].y)));
+        if (extent > 0.f) geometry->positionScale = extent;
+
+        float inverse = 1.f / geometry->positionScale;
+        for (size_t i = 0; i < points.size(); i++)
+            packed[i] = packSnorm2x16(points[i] * inverse);
+    }
+
+    return geometry->encoded.data();
+}
+
+// --------------------------------------------------------------------------
+// Streaming uploads
+
+// blocks until the GPU has finished with a ring region, then forgets its fence
+static void WaitForFence(GLsync *fence)
+{
+    if (!*fence) return;
+
+    GLbitfield flags = 0;
+    GLuint64 timeout = 0;
+    for (;;) {
+        GLenum result = glClientWaitSync(*fence, flags, timeout);
+        if (result != GL_TIMEOUT_EXPIRED) break;
+
+        // not done yet: make sure the fence is submitted, then really wait
+        flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        timeout = 1000000000;
+    }
+
+    glDeleteSync(*fence);
+    *fence = 0;
+}
+
+// (re)creates one ring buffer of the given size, mapping it if persistent
+static void AllocateStreamBuffer(Geometry *geometry, GLuint *buffer, void **mapping, GLsizeiptr bytes)
+{
+    // immutable storage can't be resized, so always start with a new buffer
+    glDeleteBuffers(1, buffer);
+    glGenBuffers(1, buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+
+    if (geometry->persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, bytes, 0, flags);
+        *mapping = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_DYNAMIC_DRAW);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// (re)creates the ring buffers with room for capacity elements per region
+static void AllocateStream(Geometry *geometry, GLsizei capacity)
+{
+    for (int i = 0; i < STREAM_REGIONS; i++) {
+        if (geometry->streamFences[i]) glDeleteSync(geometry->streamFences[i]);
+        geometry->streamFences[i] = 0;
+    }
+
+    GLsizeiptr elements = GLsizeiptr(capacity) * STREAM_REGIONS;
+    AllocateStreamBuffer(geometry, &geometry->vertexBuffer, &geometry->vertexMapping,
+                         VertexStride(geometry->format) * elements);
+    if (geometry->format == COLOURED_VERTICES) {
+        AllocateStreamBuffer(geometry, &geometry->colourBuffer, &geometry->colourMapping,
+                             ColourStride(geometry->format) * elements);
+    }
+    AllocateStreamBuffer(geometry, &geometry->tagBuffer, &geometry->tagMapping,
+                         sizeof(GLubyte) * elements);
+
+    geometry->streamCapacity = capacity;
+    geometry->streamRegion = STREAM_REGIONS - 1;
+    geometry->firstElement = geometry->streamRegion * capacity;
+    BindAttributes(geometry);
+}
+
+// copies count elements to the given element of the current region of a
+// ring buffer. The GPU is done with the region once its fence was waited
+// for, so without persistent mapping the range is mapped unsynchronized,
+// which neither waits for pending draws nor lets the driver copy the data
+static void WriteStreamRegion(Geometry *geometry, GLuint buffer, void *mapping,
+                              GLsizei stride, GLint first, GLsizei count, const void *data)
+{
+    GLintptr offset = GLintptr(stride) * (geometry->firstElement + first);
+    GLsizeiptr bytes = GLsizeiptr(stride) * count;
+    bytesUploaded += bytes;
+
+    if (geometry->persistent) {
+        memcpy(static_cast<unsigned char *>(mapping) + offset, data, bytes);
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    void *range = glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (range) {
+        memcpy(range, data, bytes);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// writes a range of the current region of every buffer of the geometry
+static void WriteStreamElements(Geometry *geometry, GLint first, GLsizei count, const void *encoded,
+                                const vec3 *pointColours, const GLubyte *pointTags)
+{
+    WriteStreamRegion(geometry, geometry->vertexBuffer, geometry->vertexMapping,
+                      VertexStride(geometry->format), first, count, encoded);
+    if (geometry->format == COLOURED_VERTICES) {
+        WriteStreamRegion(geometry, geometry->colourBuffer, geometry->colourMapping,
+                          ColourStride(geometry->format), first, count, pointColours);
+    }
+    if (geometry->tagged) {
+        WriteStreamRegion(geometry, geometry->tagBuffer, geometry->tagMapping,
+                          sizeof(GLubyte), first, count, pointTags);
+    }
+}
+
+// writes geometry data into the next free ring region; draws then start at
+// that region through firstElement, so the vertex array never changes
+static bool StreamGeometry(Geometry *geometry, const vector<vec2> &points,
+                           const vector<vec3> &pointColours, const vector<GLubyte> &pointTags)
+{
+    GLsizei count = points.size();
+    if (count > geometry->streamCapacity) {
+        AllocateStream(geometry, std::max(std::max(count, 2 * geometry->streamCapacity), MIN_STREAM_CAPACITY));
+    }
+
+    BeginGeometryUpdate(geometry);
+    if (count > 0) {
+        const void *encoded = EncodePositions(geometry, points);
+        WriteStreamElements(geometry, 0, count, encoded, pointColours.data(), pointTags.data());
+    }
+    geometry->elementCount = count;
+
+    return !CheckGLErrors();
+}
+
+int BeginGeometryUpdate(Geometry *geometry)
+{
+    if (!geometry->streaming || geometry->streamCapacity == 0) {
+        return 0;
+    }
+
+    // only stalls if the GPU is still STREAM_REGIONS frames behind
+    int region = (geometry->streamRegion + 1) % STREAM_REGIONS;
+    WaitForFence(&geometry->streamFences[region]);
+
+    geometry->streamRegion = region;
+    geometry->firstElement = region * geometry->streamCapacity;
+    return region;
+}
+
+void FenceGeometry(Geometry *geometry)
+{
+    if (!geometry->streaming || geometry->streamCapacity == 0) return;
+
+    // replaces the fence of earlier frames drawn from the same region
+    GLsync &fence = geometry->streamFences[geometry->streamRegion];
+    if (fence) glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// --------------------------------------------------------------------------
+
+// create buffers and fill with geometry data, returning true if successful
+bool LoadGeometry(Geometry *geometry, const vector<vec2> &points, const vector<vec3> &pointColours,
+                  const vector<GLubyte> &pointTags)
+{
+    // geometry without tags is never drawn as patches
+    bool tagged = !pointTags.empty();
+    if (geometry->tagged != tagged) {
+        geometry->tagged = tagged;
+        BindAttributes(geometry);
+    }
+
+    // patches all of one degree can be drawn by a program specialized for it
+    GLubyte degree = 0;
+    for (size_t i = 0; i < pointTags.size(); i++) {
+        if (pointTags[i] < 2) continue;     // not part of a patch
+        if (degree && pointTags[i] != degree) {
+            degree = 0;
+            break;
+        }
+        degree = pointTags[i];
+    }
+    geometry->patchDegree = degree;
+
+    if (geometry->streaming) {
+        return StreamGeometry(geometry, points, pointColours, pointTags);
+    }
+
+    geometry->firstElement = 0;
+    geometry->elementCount = points.size();
+
+    // create an array buffer object for storing our vertices
+    const void *encoded = EncodePositions(geometry, points);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, VertexStride(geometry->format) * geometry->elementCount, encoded, GL_STATIC_DRAW);
+    bytesUploaded += VertexStride(geometry->format) * geometry->elementCount;
+
+    // create another one for storing our colours
+    if (geometry->format == COLOURED_VERTICES) {
+        glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * geometry->elementCount, pointColours.data(), GL_STATIC_DRAW);
+        bytesUploaded += sizeof(vec3) * geometry->elementCount;
+    }
+
+    // and one for the tags of vertices
+    if (geometry->tagged) {
+        glBindBuffer(GL_ARRAY_BUFFER, geometry->tagBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLubyte) * geometry->elementCount, pointTags.data(), GL_STATIC_DRAW);
+        bytesUploaded += sizeof(GLubyte) * geometry->elementCount;
+    }
+
+    //Unbind buffer to reset to default state
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // check for OpenGL errors and return false if error occurred
+    return !CheckGLErrors();
+}
+
+bool ReserveGeometry(Geometry *geometry, GLsizei capacity)
+{
+    if (geometry->format != COLOURED_VERTICES) {
+        cout << "Only coloured geometry is reserved and updated in ranges" << endl;
+        return false;
+    }
+
+    if (!geometry->tagged) {
+        geometry->tagged = true;
+        BindAttributes(geometry);
+    }
+    geometry->patchDegree = 0;
+    geometry->firstElement = 0;
+    geometry->elementCount = capacity;
+
+    // every region of the ring gets the whole capacity
+    if (geometry->streaming) {
+        AllocateStream(geometry, capacity);
+        return !CheckGLErrors();
+    }
+
+    // the ranges are rewritten now and then, but drawn far more often
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * capacity, 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * capacity, 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->tagBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLubyte) * capacity, 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return !CheckGLErrors();
+}
+
+bool UpdateGeometry(Geometry *geometry, GLint first, GLsizei count, const vec2 *points,
+                    const vec3 *pointColours, const GLubyte *pointTags)
+{
+    if (!geometry->tagged || geometry->format != COLOURED_VERTICES) {
+        cout << "Only reserved geometry is updated in ranges" << endl;
+        return false;
+    }
+    GLsizei capacity = geometry->streaming ? geometry->streamCapacity : geometry->elementCount;
+    if (first < 0 || count < 0 || first + count > capacity) {
+        cout << "Geometry update of " << count << " vertices at " << first
+             << " is outside its " << capacity << endl;
+        return false;
+    }
+    if (count == 0) return true;
+
+    if (geometry->streaming) {
+        WriteStreamElements(geometry, first, count, points, pointColours, pointTags);
+        return !CheckGLErrors();
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec2) * first, sizeof(vec2) * count, points);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec3) * first, sizeof(vec3) * count, pointColours);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->tagBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(GLubyte) * first, sizeof(GLubyte) * count, pointTags);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bytesUploaded += (sizeof(vec2) + sizeof(vec3) + sizeof(GLubyte)) * count;
+
+    return !CheckGLErrors();
+}
+
+bool LoadTextureCoords(Geometry *geometry, const vector<vec2> &textureCoords)
+{
+    if (geometry->streaming) {
+        cout << "Streaming geometry can't have texture coordinates" << endl;
+        return false;
+    }
+
+    if (!geometry->textureBuffer) {
+        glGenBuffers(1, &geometry->textureBuffer);
+        BindAttributes(geometry);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->textureBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * textureCoords.size(), textureCoords.data(), GL_STATIC_DRAW);
+    bytesUploaded += sizeof(vec2) * textureCoords.size();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return !CheckGLErrors();
+}
+
+bool LoadInstances(Geometry *geometry, const vector<GeometryInstance> &instances,
+                   const vector<GeometryBatch> &batches)
+{
+    if (geometry->format == COLOURED_VERTICES) {
+        cout << "Instanced geometry can't have per-vertex colours" << endl;
+        return false;
+    }
+    if (geometry->streaming) {
+        // batch ranges don't follow firstElement around the ring
+        cout << "Streaming geometry can't be instanced" << endl;
+        return false;
+    }
+
+    if (!geometry->instanceBuffer) {
+        glGenBuffers(1, &geometry->instanceBuffer);
+        BindAttributes(geometry);
+    }
+    geometry->batches = batches;
+
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GeometryInstance) * instances.size(), instances.data(), GL_DYNAMIC_DRAW);
+    bytesUploaded += sizeof(GeometryInstance) * instances.size();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return !CheckGLErrors();
+}
+
+bool SetVisibleBatches(Geometry *geometry, const vector<GeometryBatch> &batches)
+{
+    if (!geometry->instanceBuffer) {
+        cout << "Only instanced geometry has its batches culled" << endl;
+        return false;
+    }
+
+    geometry->batches = batches;
+    return true;
+}
+
+static bool CompareBatchModes(const GeometryBatch &a, const GeometryBatch &b)
+{
+    return a.mode < b.mode;
+}
+
+bool LoadBatches(Geometry *geometry, const vector<GeometryBatch> &batches)
+{
+    if (geometry->streaming || geometry->instanceBuffer) {
+        // batch ranges don't follow firstElement around the ring
+        cout << "Only static geometry that isn't instanced has its own batches" << endl;
+        return false;
+    }
+
+    geometry->batches = batches;
+    stable_sort(geometry->batches.begin(), geometry->batches.end(), CompareBatchModes);
+
+    geometry->batchFirsts.clear();
+    geometry->batchCounts.clear();
+    for (const GeometryBatch &batch : geometry->batches) {
+        geometry->batchFirsts.push_back(batch.first);
+        geometry->batchCounts.push_back(batch.count);
+    }
+    return true;
+}
+
+void BindGeometry(const Geometry *geometry)
+{
+    glBindVertexArray(geometry->vertexArray);
+
+    // with its array disabled, the colour attribute reads this constant
+    if (geometry->format != COLOURED_VERTICES) {
+        glVertexAttrib3fv(COLOUR_INDEX, value_ptr(geometry->colour));
+    }
+
+    // and geometry that isn't instanced is drawn where it is
+    glVertexAttrib3f(PLACEMENT_INDEX, 0.f, 0.f, 1.f);
+}
+
+void DrawGeometry(const Geometry *geometry, GLenum mode)
+{
+    if (!geometry->instanceBuffer && geometry->batches.empty()) {
+        glDrawArrays(mode, geometry->firstElement, geometry->elementCount);
+        return;
+    }
+
+    // batches of the same type are next to each other, and drawn together
+    if (!geometry->instanceBuffer) {
+        const vector<GeometryBatch> &batches = geometry->batches;
+        size_t first = 0;
+        while (first < batches.size() && batches[first].mode != mode) first++;
+        size_t end = first;
+        while (end < batches.size() && batches[end].mode == mode) end++;
+
+        if (end > first) {
+            glMultiDrawArrays(mode, &geometry->batchFirsts[first], &geometry->batchCounts[first],
+                              GLsizei(end - first));
+        }
+        return;
+    }
+
+    // without base instances (GL 4.2) each batch moves the instance arrays
+    // to its own first instance instead
+    GLsizei stride = sizeof(GeometryInstance);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->instanceBuffer);
+    for (const GeometryBatch &batch : geometry->batches) {
+        if (batch.mode != mode) continue;
+
+        size_t first = size_t(batch.firstInstance) * stride;
+        glVertexAttribPointer(PLACEMENT_INDEX, 3, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<const void *>(first + offsetof(GeometryInstance, offset)));
+        glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<const void *>(first + offsetof(GeometryInstance, colour)));
+        glDrawArraysInstanced(mode, batch.first, batch.count, batch.instanceCount);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// deallocate geometry-related objects
+void DestroyGeometry(Geometry *geometry)
+{
+    for (int i = 0; i < STREAM_REGIONS; i++) {
+        if (geometry->streamFences[i]) glDeleteSync(geometry->streamFences[i]);
+        geometry->streamFences[i] = 0;
+    }
+
+    // unbind and destroy our vertex array object and associated buffers;
+    // deleting a buffer also releases any persistent mapping of it
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &geometry->vertexArray);
+    glDeleteBuffers(1, &geometry->vertexBuffer);
+    glDeleteBuffers(1, &geometry->textureBuffer);
+    glDeleteBuffers(1, &geometry->colourBuffer);
+    glDeleteBuffers(1, &geometry->tagBuffer);
+    glDeleteBuffers(1, &geometry->instanceBuffer);
+    geometry->vertexMapping = 0;
+    geometry->colourMapping = 0;
+    geometry->tagMapping = 0;
+}
+
+size_t GeometryBytesUploaded()
+{
+    return bytesUploaded;
+}
+
+// --------------------------------------------------------------------------
+// Transform feedback capture
+
+const char *const CAPTURE_VARYINGS[] = { "gl_Position", "Colour" };
+
+// bytes per captured vertex, and where its colour is
+static const GLsizei CAPTURE_STRIDE = sizeof(vec4) + sizeof(vec3);
+static const size_t CAPTURE_COLOUR_OFFSET = sizeof(vec4);
+
+CapturedCurves::CapturedCurves()
+    : buffer(0), vertexArray(0), query(0), capacity(0), vertexCount(0)
+{}
+
+bool InitializeCapture(CapturedCurves *capture)
+{
+    glGenBuffers(1, &capture->buffer);
+    glGenQueries(1, &capture->query);
+
+    glGenVertexArrays(1, &capture->vertexArray);
+    glBindVertexArray(capture->vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, capture->buffer);
+    glVertexAttribPointer(VERTEX_INDEX, 4, GL_FLOAT, GL_FALSE, CAPTURE_STRIDE, 0);
+    glEnableVertexAttribArray(VERTEX_INDEX);
+    glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, CAPTURE_STRIDE,
+                          reinterpret_cast<const void *>(CAPTURE_COLOUR_OFFSET));
+    glEnableVertexAttribArray(COLOUR_INDEX);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    return !CheckGLErrors();
+}
+
+bool CaptureCurves(CapturedCurves *capture, const Geometry *geometry)
+{
+    capture->vertexCount = 0;
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    // tessellation levels depend on where the patches end up on screen, so
+    // the only way to size the buffer is to run them once and count
+    GLuint lines = 0;
+    glBeginQuery(GL_PRIMITIVES_GENERATED, capture->query);
+    DrawGeometry(geometry, GL_PATCHES);
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    glGetQueryObjectuiv(capture->query, GL_QUERY_RESULT, &lines);
+
+    GLsizeiptr bytes = GLsizeiptr(lines) * 2 * CAPTURE_STRIDE;
+    if (bytes > capture->capacity) {
+        capture->capacity = std::max(bytes, 2 * capture->capacity);
+        glBindBuffer(GL_ARRAY_BUFFER, capture->buffer);
+        glBufferData(GL_ARRAY_BUFFER, capture->capacity, 0, GL_STATIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    if (lines > 0) {
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, capture->buffer);
+        glBeginTransformFeedback(GL_LINES);
+        DrawGeometry(geometry, GL_PATCHES);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    }
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    capture->vertexCount = 2 * lines;
+
+    return !CheckGLErrors();
+}
+
+void DrawCapturedCurves(const CapturedCurves *capture)
+{
+    glBindVertexArray(capture->vertexArray);
+    glDrawArrays(GL_LINES, 0, capture->vertexCount);
+}
+
+void DestroyCapture(CapturedCurves *capture)
+{
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &capture->vertexArray);
+    glDeleteBuffers(1, &capture->buffer);
+    glDeleteQueries(1, &capture->query);
+    capture->capacity = 0;
+    capture->vertexCount = 0;
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// --------------------------------------------------------------------------
+// Functions to set up OpenGL buffers for storing geometry data
+
+// Layouts of the vertex buffer. Per-vertex colours are only kept for the
+// demo curves, which really do use per-control-point gradients; the compact
+// formats store positions alone and colour each draw with a constant.
+enum VertexFormat
+{
+    COLOURED_VERTICES,      // float positions plus a separate colour buffer
+    FLOAT_POSITIONS,        // 8 bytes per vertex
+    HALF_POSITIONS,         // 4 bytes per vertex, half floats
+    SNORM16_POSITIONS       // 4 bytes per vertex, normalized to positionScale
+};
+
+// Placement of one instance of instanced geometry, such as one character
+// of a string drawing a shared glyph: positions are offset, then scaled
+struct GeometryInstance
+{
+    glm::vec2 offset;
+    float     scale;
+    glm::vec3 colour;
+};
+
+// A range of elements drawn as the given primitive type, once for each of
+// a range of instances
+struct GeometryBatch
+{
+    GLenum  mode;
+    GLint   first;
+    GLsizei count;
+    GLint   firstInstance;
+    GLsizei instanceCount;
+};
+
+// number of regions in the ring buffers of streaming geometry: the CPU
+// writes one while the GPU may still be drawing from the other two
+const int STREAM_REGIONS = 3;
+
+struct Geometry
+{
+    // OpenGL names for array buffer objects, vertex array object
+    GLuint  vertexBuffer;
+    GLuint  textureBuffer;  // created by the first LoadTextureCoords
+    GLuint  colourBuffer;
+    GLuint  tagBuffer;      // small integer per vertex, e.g. the patch degree
+    GLuint  vertexArray;
+    GLint   firstElement;   // draws start here; moves around when streaming
+    GLsizei elementCount;
+
+    // vertex layout; compact formats draw in a single colour, and positions
+    // are multiplied by positionScale in the vertex shader
+    VertexFormat format;
+    float   positionScale;
+    glm::vec3 colour;
+    bool    tagged;         // has a tag for every vertex
+    GLubyte patchDegree;    // shared by every patch, or 0 if they differ
+    std::vector<unsigned char> encoded;    // staging for compact uploads
+
+    // instanced geometry draws its batches, taking colours and placements
+    // from the instance buffer, instead of the elements given above
+    GLuint  instanceBuffer;
+    std::vector<GeometryBatch> batches;
+
+    // geometry that isn't instanced can have batches too, sorted by
+    // primitive type, with their ranges kept as arrays for multi-draws
+    std::vector<GLint>   batchFirsts;
+    std::vector<GLsizei> batchCounts;
+
+    // streaming geometry is rewritten through a ring of buffer regions, so
+    // an upload never has to wait for a frame the GPU is still drawing
+    bool    streaming;
+    bool    persistent;     // regions are persistently mapped (ARB_buffer_storage)
+    GLsizei streamCapacity; // elements per region
+    int     streamRegion;   // region written by the latest upload
+    GLsync  streamFences[STREAM_REGIONS];
+    void   *vertexMapping;
+    void   *colourMapping;
+    void   *tagMapping;
+
+    // initialize object names to zero (OpenGL reserved value)
+    Geometry();
+};
+
+//Creates the buffers and vertex array object for a geometry
+// ARGS:
+//    geometry - Geometry to initialize
+//    format - Layout of the vertex data in the buffers
+//    streaming - Set for data that really does change every frame; uploads
+//        then go through a triple-buffered ring instead of reallocating, and
+//        FenceGeometry must follow the draws of every frame
+bool InitializeVAO(Geometry *geometry, VertexFormat format = COLOURED_VERTICES,
+                   bool streaming = false);
+
+// fill buffers with geometry data, returning true if successful; colours are
+// only used by COLOURED_VERTICES geometry. Tags are read by the shaders as
+// an integer attribute: patches always have four control points, each
+// tagged with the degree (2 or 3) of the curve it belongs to.
+bool LoadGeometry(Geometry *geometry, const std::vector<glm::vec2> &points,
+                  const std::vector<glm::vec3> &pointColours = std::vector<glm::vec3>(),
+                  const std::vector<GLubyte> &pointTags = std::vector<GLubyte>());
+
+// allocates room for capacity coloured, tagged vertices without filling
+// it, for geometry whose ranges are written separately by UpdateGeometry;
+// any earlier contents are lost. Streaming geometry gets the capacity in
+// each region of its ring.
+bool ReserveGeometry(Geometry *geometry, GLsizei capacity);
+
+// moves streaming geometry on to the next region of its ring, waiting
+// until the GPU has finished the draws FenceGeometry last marked in it; the
+// ranges UpdateGeometry writes then go to that region, and draws read from
+// it. A region keeps what was last written to it, so the caller has to
+// bring it up to date with everything changed since it was last used.
+// Returns the region, or 0 for static geometry, which has only the one.
+int BeginGeometryUpdate(Geometry *geometry);
+
+// fences the region of streaming geometry the draws just issued read from,
+// so it isn't written again until they're done; does nothing otherwise
+void FenceGeometry(Geometry *geometry);
+
+// rewrites count vertices from first on, leaving the rest of the buffers
+// (or of the current region) as they were; the range has to lie within the
+// reserved capacity
+bool UpdateGeometry(Geometry *geometry, GLint first, GLsizei count, const glm::vec2 *points,
+                    const glm::vec3 *pointColours, const GLubyte *pointTags);
+
+// fill the texture coordinate buffer, one coordinate for each of the points
+// last loaded; the coordinates are read at attribute location 4. Streaming
+// geometry doesn't support textures.
+bool LoadTextureCoords(Geometry *geometry, const std::vector<glm::vec2> &textureCoords);
+
+// fill the instance buffer of compact geometry, which is drawn instanced
+// from then on; batches refer to ranges of the given instances. Streaming
+// geometry can't be instanced.
+bool LoadInstances(Geometry *geometry, const std::vector<GeometryInstance> &instances,
+                   const std::vector<GeometryBatch> &batches);
+
+// replaces the batches of instanced geometry with ones over the same
+// instances, such as those left after culling; nothing is uploaded
+bool SetVisibleBatches(Geometry *geometry, const std::vector<GeometryBatch> &batches);
+
+// sets the batches of geometry that isn't instanced: each primitive type is
+// then drawn from its own ranges of the elements, in a single draw call,
+// instead of from all of them. Instance ranges are ignored, and streaming
+// geometry doesn't support batches.
+bool LoadBatches(Geometry *geometry, const std::vector<GeometryBatch> &batches);
+
+// binds the vertex array for drawing, along with the constant colour of
+// compact geometry
+void BindGeometry(const Geometry *geometry);
+
+// draws bound geometry with the given primitive type; instanced geometry
+// makes one instanced draw per batch of that type, and other geometry with
+// batches one multi-draw over all of them
+void DrawGeometry(const Geometry *geometry, GLenum mode);
+
+// deallocate geometry-related objects
+void DestroyGeometry(Geometry *geometry);
+
+// bytes of vertex, instance and texture coordinate data sent to buffers by
+// the functions above since the program started, for profiling
+size_t GeometryBytesUploaded();
+
+// --------------------------------------------------------------------------
+// Functions to capture tessellated curves with transform feedback
+
+// The line segments the tessellation stages turned the patches of some
+// geometry into, as clip space positions and colours, so that a static
+// scene can be drawn again without tessellating it every frame
+struct CapturedCurves
+{
+    GLuint  buffer;         // interleaved vec4 positions and vec3 colours
+    GLuint  vertexArray;
+    GLuint  query;          // counts the lines before they are captured
+    GLsizeiptr capacity;    // bytes allocated in the buffer
+    GLsizei vertexCount;    // two for every line
+
+    // initialize object names to zero (OpenGL reserved value)
+    CapturedCurves();
+};
+
+// outputs of the last tessellation stage that are captured, in order; the
+// capturing program has to be linked with them as interleaved varyings
+extern const char *const CAPTURE_VARYINGS[];
+const GLsizei CAPTURE_VARYING_COUNT = 2;
+
+// creates the buffer, vertex array and query of a capture
+bool InitializeCapture(CapturedCurves *capture);
+
+// replaces the capture with the patches of the bound geometry, run through
+// the bound program, whose evaluation stage must output isolines; nothing
+// is drawn. Counting the lines first waits for the GPU, so this is meant
+// for geometry that then stays the same for many frames.
+bool CaptureCurves(CapturedCurves *capture, const Geometry *geometry);
+
+// draws the captured lines with the current program, which reads the clip
+// space positions at location 0 and the colours at location 1
+void DrawCapturedCurves(const CapturedCurves *capture);
+
+// deallocate capture-related objects
+void DestroyCapture(CapturedCurves *capture);
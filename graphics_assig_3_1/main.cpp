@@ -14,10 +14,17 @@
 // ==========================================================================
 
 #include <iostream>
+#include <iomanip>
+#include <cctype>
+#include <cfloat>
+#include <cstdio>
 #include <fstream>
 #include <algorithm>
 #include <string>
+#include <string_view>
 #include <iterator>
+#include <map>
+#include <memory>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -27,7 +34,14 @@
 #include <GLFW/glfw3.h>
 
 #include "texture.h"
-#include "fonts/GlyphExtractor.h"
+#include "geometry.h"
+#include "shader.h"
+#include "profiler.h"
+#include "flatten.h"
+#include "scene.h"
+#include "fonts/GlyphService.h"
+#include "fonts/FontLoader.h"
+#include "fonts/DistanceField.h"
 
 using namespace std;
 using namespace glm;
@@ -36,6 +50,7 @@ using namespace glm;
 
 void QueryGLVersion();
 bool CheckGLErrors();
+void CheckDrawErrors();
 
 enum BezierCurve
 {
@@ -52,27 +67,186 @@ enum FontLoaded
     NO_FONT
 };
 
-string LoadSource(const string &filename);
+// Every glyph drawn so far, kept once in EM units: its curves as patches,
+// followed by its straight segments as lines, then the triangles that fill
+// it. Text objects draw the glyphs of their characters as instances, so a
+// string costs one copy of each different glyph in it.
+struct GlyphAtlasEntry
+{
+    GLint   first;              // range of the control points of curves
+    GLsizei count;
+    GLint   lineFirst;          // range of the end points of lines
+    GLsizei lineCount;
+    GLint   fillFirst;          // range of the triangles filling the stencil
+    GLsizei fillCount;
+    GLint   coverFirst;         // strip of four corners covering the glyph
+    MyBounds bounds;            // of the outline, for culling
+};
+
+// corners of the triangles that fill glyphs, as tagged on their vertices
+enum FillCorner
+{
+    FILL_INTERIOR,              // any corner of a triangle inside the glyph
+    FILL_CURVE_START,           // corners of the triangle around a quadratic
+    FILL_CURVE_CONTROL,
+    FILL_CURVE_END
+};
+
+typedef pair<string, int> GlyphAtlasKey;   // font file and code point
+
+struct GlyphAtlas
+{
+    vector<vec2> vertices;
+    vector<GLubyte> tags;       // patch degrees, or corners of fill triangles
+    map<GlyphAtlasKey, GlyphAtlasEntry> entries;
+    bool        dirty;          // glyphs were added since the last upload
+
+    // vertices every glyph of the fonts loaded so far would take, reserved
+    // as each font comes in so adding glyphs never reallocates
+    size_t      reservedVertices;
+
+    GlyphAtlas() : dirty(false), reservedVertices(0) {}
+};
+
+// The same glyphs as an image of signed distances, for text drawn as one
+// textured quad per character. Each entry is the strip of four corners of
+// the glyph's quad, with texture coordinates into the distance field.
+struct DistanceAtlasEntry
+{
+    GLint   first;
+    bool    empty;              // nothing to draw, or no room in the atlas
+    MyBounds bounds;            // of the quad, for culling
+};
+
+struct DistanceAtlas
+{
+    DistanceFieldAtlas field;
+    vector<vec2> vertices;
+    vector<vec2> textureCoords;
+    map<GlyphAtlasKey, DistanceAtlasEntry> entries;
+    bool        dirty;          // glyphs were added since the last upload
+
+    // corners of every glyph's quad of the fonts loaded so far, as above
+    size_t      reservedVertices;
+
+    DistanceAtlas() : dirty(false), reservedVertices(0) {}
+};
+
+// how a text object is drawn: outlines and filled text share the glyph
+// atlas and their layout, while distance field text has its own
+enum TextStyle
+{
+    OUTLINED_TEXT,
+    FILLED_TEXT,
+    DISTANCE_FIELD_TEXT
+};
+
+// A retained text object: a string laid out in a given font, as instances
+// of the atlas glyphs. It is only laid out again when its string, font,
+// scale or colour is changed through the setText* functions; moving it
+// horizontally only changes its model transform, which is applied on the
+// GPU.
+struct TextObject
+{
+    string      text;
+    string      fontFile;
+    float       yShiftBy;       // vertical offset in EM units
+    float       scaleBy;
+    vec3        colour;
+    TextStyle   style;
+    mat4        transform;      // model transform, not part of the layout
+
+    // a font switched to while it was still loading; the text keeps its
+    // current layout until the font is ready
+    string      pendingFont;
+
+    // the string's glyphs and pen positions, shared with every other text
+    // object showing the same string in the same font
+    shared_ptr<const GlyphRun> run;
+
+    // one instance per visible character, grouped into batches per glyph,
+    // with the bounds of each batch's glyph; current when not dirty
+    vector<GeometryInstance> instances;
+    vector<GeometryBatch> batches;
+    vector<MyBounds> batchBounds;
+    bool        dirty;
+    
+    // the batches cut down to the instances on screen, every frame
+    vector<GeometryBatch> visibleBatches;
+
+    TextObject() : yShiftBy(0.f), scaleBy(1.f),
+                   colour(1.f, 1.f, 1.f), style(OUTLINED_TEXT), transform(1.f), dirty(true)
+    {}
+};
+
+// One of the many small numbers of the label scene. Each is an object of
+// the shared scene arena, outlined in its own font, so changing its value
+// only rewrites its own range of the arena.
+struct Label
+{
+    SceneHandle handle;         // NO_SCENE_OBJECT until its font is in
+    const char *fontFile;
+    int         value;          // the number shown
+    mat4        transform;      // placement in clip space
+    vec3        colour;
+    bool        dirty;          // its shape has to be built again
+};
+
+string LoadSource(const string &filename, const string &defines = "");
 GLuint CompileShader(GLenum shaderType, const string &source);
-GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint tcsShader, GLuint tesShader);
+GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint tcsShader, GLuint tesShader,
+                   const char *const *feedbackVaryings = 0, GLsizei feedbackVaryingCount = 0);
 void addVertices(BezierCurve type);
 void addColours();
-float insertGlyphCharacter(char charToInsert, float advance, float shiftToCentre, float scaleToFit);
-void insertString(string text);
+void padPatches(BezierCurve type);
+void addControlPolygon(BezierCurve type);
+const GlyphAtlasEntry &findAtlasGlyph(GlyphAtlas *atlas, const string &fontFile, int character,
+                                      const MyGlyph &myGlyph);
+const DistanceAtlasEntry &findDistanceGlyph(DistanceAtlas *atlas, const string &fontFile, int character,
+                                            const MyGlyph &myGlyph);
+void insertString(TextObject *textObject, GlyphAtlas *atlas);
+void setTextString(TextObject *textObject, string_view text);
+void setTextFont(TextObject *textObject, const string &fontFile);
+void setTextPlacement(TextObject *textObject, float shiftBy, float yShiftBy, float scaleBy);
+void setTextColour(TextObject *textObject, vec3 colour);
+void setTextStyle(TextObject *textObject, TextStyle style);
+bool updateText(TextObject *textObject, GlyphAtlas *atlas);
+void requestFont(const string &fontFile);
+const LoadedFont *findLoadedFont(string_view fontFile);
+void adoptLoadedFonts(TextObject *textObject);
+void reserveAtlases(const LoadedFont &font);
+bool updateStats();
+void mergeText(const TextObject *textObjects, int count, vector<GeometryInstance> *instances,
+               vector<GeometryBatch> *batches);
+void cullText(TextObject *textObject, const mat4 &modelTransform, const FrameUniforms &frame);
+void scrollText();
+bool buildLabelShape(const Label &label);
+void createLabels(int count);
+void updateLabels();
+bool isFrameNeeded();
+bool isAnimating();
+int chooseSwapInterval(int frameRate);
 void loadLoraBoldItalic();
 void loadInconsolata();
 void loadQarmicSans();
 void loadAlexBrush();
-mat4 translateText(mat4 transform);
+mat4 translateText(mat4 transform, float distance);
 
+// control points, colours and patch degrees of the Q/W demo curves,
+// followed by the edges of their control polygons; the batches draw the
+// patches, the control points and the polygons
 vector<vec2> vertices;
 vector<vec3> colours;
+vector<GLubyte> degrees;
+vector<GeometryBatch> curveBatches;
+bool curvesDirty = false;
 
-float cubicBezier;
-float quadraticBezier;
-float drawPoints;
+// lines of the demo curves flattened on the CPU, kept between figures so
+// switching them doesn't allocate once they've grown
+vector<vec2> flattenedLines;
+vector<vec3> flattenedColours;
 
-FontLoaded fontLoaded;
+FontLoaded fontLoaded = NO_FONT;
 float scaleBy;
 float shiftBy;
 float fontShiftBy;
@@ -80,33 +254,164 @@ float fontYShiftBy;
 float fontScaleBy;
 float resetScroll;
 BezierCurve bezierType;
-mat4 transformVertices = mat4(1.0f);
+
+// largest distance, in pixels, of tessellated curves from the true curves
+float tessFlatness = 0.25f;
+
+// without tessellation stages (or with --cpu-curves) the curves are
+// flattened into lines on the CPU as they are added, to within these
+// distances: in the units of the demo figures, and in EM units for glyphs
+bool cpuCurves = false;
+const float CPU_CURVE_TOLERANCE = 0.005f;
+const float CPU_GLYPH_TOLERANCE = 0.001f;
 
 float origLocation = 0.f;
 bool textIsScrolling = false;
-float textScrollSpeed = 0.05;
+float textScrollSpeed = 0.05;           // per sixtieth of a second
+double scrollUpdated = 0.0;             // when the text last moved
+
+// the main loop only draws when something shown has changed, sleeping until
+// an event otherwise; scrolling text moves at the target frame rate (0 for
+// as fast as possible), paced by the swap interval where the display's
+// refresh rate allows, else by the loop's own timer
+int targetFrameRate = 60;
+bool redrawNeeded = true;               // input or the window asked for a frame
+const double IDLE_WAIT = 1.0;           // longest sleep with nothing to do
+
+GlyphService glyphService;
+
+// layouts of the demo text's strings shown recently, so showing one again
+// doesn't lay it out again. The labels lay theirs out from their loaded
+// fonts instead: a counter seldom shows a value again soon, so their runs
+// would only push the text's out.
+ShapedRunCache shapedRuns;
+
+// fonts of the text demos, all loaded in the background at start up
+const char *const LORA_BOLD_ITALIC_FILE = "fonts/lora/Lora-BoldItalic.ttf";
+const char *const SOURCE_SANS_FILE = "fonts/source-sans-pro/SourceSansPro-SemiboldIt.otf";
+const char *const QARMIC_SANS_FILE = "fonts/Qarmic_sans_Abridged.ttf";
+const char *const ALEX_BRUSH_FILE = "fonts/alex-brush/AlexBrush-Regular.ttf";
+
+// fonts whose glyphs are decoded, or null while still loading; runs laid
+// out from one keep it alive even if it's replaced here. The comparison
+// is transparent, so the labels' file names are looked up without being
+// copied into a string every frame.
+FontLoader fontLoader;
+map<string, shared_ptr<const LoadedFont>, less<> > loadedFonts;
+GlyphAtlas glyphAtlas;
+DistanceAtlas distanceAtlas;
+MyTexture distanceTexture;
+size_t distanceBytesUploaded = 0;   // texels of distance field uploads
+TextObject textObject;
 
-GlyphExtractor glyphExtractor;
-MyGlyph myGlyph;
+// frame times, and the overlay showing them: a line for the whole frame,
+// then one for each phase, outlined from an atlas of their own
+Profiler profiler;
+bool showStats = false;
+TextObject statsLines[PROFILE_SECTIONS + 1];
+GlyphAtlas statsAtlas;
+double statsUpdated = 0.0;      // when the overlay's numbers last changed
+const double STATS_REFRESH_INTERVAL = 0.25;
+
+// the label scene: a grid of counters sharing one arena, one of them
+// counting up every frame; each program draws all of them in one call
+SceneArena labelScene;
+vector<Label> labels;
+bool showLabels = false;
+int labelCount = 200;           // --labels <n>
+size_t nextLabel = 0;           // counts up next
+GlyphRun labelRun;              // staging for building a label's shape
+SceneShape labelShape;
+vector<vec2> labelLines;
 
 // --------------------------------------------------------------------------
 // Functions to set up OpenGL shader programs for rendering
 
-// load, compile, and link shaders, returning true if successful
-GLuint InitializeShaders()
+// What a program outlining curves is specialized for. Every combination is
+// compiled from the same sources with its own #defines, so the shaders
+// don't decide per vertex what they are drawing.
+struct ProgramVariant
 {
-    // load shader source from files
-    string vertexSource = LoadSource("shaders/vertex.glsl");
-    string fragmentSource = LoadSource("shaders/fragment.glsl");
-    string tcsSource = LoadSource("shaders/tessControl.glsl");
-    string tesSource = LoadSource("shaders/tessEval.glsl");
+    int  degree;        // of every patch drawn, or 0 to read each patch's tag
+    bool blended;       // colours blend between control points, or are constant
+    bool overlay;       // draws points and lines as they are, untessellated
+    bool objects;       // draws a scene arena, transforming each of its objects
+    
+    bool operator<(const ProgramVariant &other) const
+    {
+        if (overlay != other.overlay) return overlay < other.overlay;
+        if (objects != other.objects) return objects < other.objects;
+        if (degree != other.degree) return degree < other.degree;
+        return blended < other.blended;
+    }
+};
+
+// the control points and straight lines; the other fields don't matter
+const ProgramVariant OVERLAY_VARIANT = { 0, true, true, false };
+
+// draws any patches, reading their degree from their tags
+const ProgramVariant GENERIC_VARIANT = { 0, true, false, false };
+
+// the label scene's lines, and its patches of each degree
+const ProgramVariant LABEL_LINES_VARIANT = { 0, true, true, true };
+const ProgramVariant LABEL_QUADRATICS_VARIANT = { 2, true, false, true };
+const ProgramVariant LABEL_CUBICS_VARIANT = { 3, true, false, true };
+
+// names the variant, for its cache file
+string variantName(const ProgramVariant &variant)
+{
+    string name = variant.overlay ? "overlay" : "outline";
+    if (!variant.overlay) {
+        if (variant.degree == 2) name += "-quadratic";
+        if (variant.degree == 3) name += "-cubic";
+        if (!variant.blended) name += "-flat";
+    }
+    if (variant.objects) name += "-objects";
+    return name;
+}
+
+// the #defines that specialize the shaders for the variant
+string variantDefines(const ProgramVariant &variant)
+{
+    string defines;
+    if (variant.objects) defines += "#define OBJECT_BLOCK " + to_string(SCENE_BLOCK) + "\n";
+    if (variant.overlay) return defines + "#define OVERLAY\n";
+    
+    if (variant.degree) defines += "#define PATCH_DEGREE " + to_string(variant.degree) + "\n";
+    if (!variant.blended) defines += "#define FLAT_COLOUR\n";
+    return defines;
+}
+
+// load, compile, and link the shaders of a variant, returning the program,
+// or 0 if unsuccessful
+GLuint initializeVariantShaders(const ProgramVariant &variant)
+{
+    // load shader source from files; the overlay isn't tessellated
+    string defines = variantDefines(variant);
+    string vertexSource = LoadSource("shaders/vertex.glsl", defines);
+    string fragmentSource = LoadSource("shaders/fragment.glsl", defines);
+    string tcsSource, tesSource;
+    if (!variant.overlay) {
+        tcsSource = LoadSource("shaders/tessControl.glsl", defines);
+        tesSource = LoadSource("shaders/tessEval.glsl", defines);
+        if (tcsSource.empty() || tesSource.empty()) return 0;
+    }
     if (vertexSource.empty() || fragmentSource.empty()) return 0;
     
+    // reuse the program linked on an earlier run, if the driver still takes it
+    const string cacheFile = "shaders/" + variantName(variant) + ".programbinary";
+    vector<string> sources = { vertexSource, fragmentSource, tcsSource, tesSource };
+    GLuint cached = LoadProgramBinary(cacheFile, sources);
+    if (cached) return cached;
+    
     // compile shader source into shader objects
     GLuint vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
     GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
-    GLuint tcs = CompileShader(GL_TESS_CONTROL_SHADER, tcsSource);
-    GLuint tes = CompileShader(GL_TESS_EVALUATION_SHADER, tesSource);
+    GLuint tcs = GL_FALSE, tes = GL_FALSE;
+    if (!variant.overlay) {
+        tcs = CompileShader(GL_TESS_CONTROL_SHADER, tcsSource);
+        tes = CompileShader(GL_TESS_EVALUATION_SHADER, tesSource);
+    }
     
     // link shader program
     GLuint program = LinkProgram(vertex, fragment, tcs, tes);
@@ -119,21 +424,30 @@ GLuint InitializeShaders()
     if (CheckGLErrors())
         return 0;
     
+    SaveProgramBinary(program, cacheFile, sources);
+    
     // check for OpenGL errors and return false if error occurred
     return program;
 }
 
-GLuint initializePointShaders()
+GLuint initializeFillShaders()
 {
-    string pointVertexSource = LoadSource("shaders/pointVertex.glsl");
-    string pointFragmentSource = LoadSource("shaders/pointFragment.glsl");
+    string fillVertexSource = LoadSource("shaders/fillVertex.glsl");
+    string fillFragmentSource = LoadSource("shaders/fillFragment.glsl");
     
-    if (pointVertexSource.empty() || pointFragmentSource.empty()) {
+    if (fillVertexSource.empty() || fillFragmentSource.empty()) {
         return 0;
     }
     
-    GLuint vertex = CompileShader(GL_VERTEX_SHADER, pointVertexSource);
-    GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, pointFragmentSource);
+    const string cacheFile = "shaders/fill.programbinary";
+    vector<string> sources = { fillVertexSource, fillFragmentSource };
+    GLuint cached = LoadProgramBinary(cacheFile, sources);
+    if (cached) {
+        return cached;
+    }
+    
+    GLuint vertex = CompileShader(GL_VERTEX_SHADER, fillVertexSource);
+    GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, fillFragmentSource);
     
     GLuint program = LinkProgram(vertex, fragment, GL_FALSE, GL_FALSE);
     
@@ -144,176 +458,531 @@ GLuint initializePointShaders()
         return 0;
     }
     
+    SaveProgramBinary(program, cacheFile, sources);
+    
     return program;
 }
 
-// --------------------------------------------------------------------------
-// Functions to set up OpenGL buffers for storing geometry data
-
-struct Geometry
+GLuint initializeDistanceShaders()
 {
-    // OpenGL names for array buffer objects, vertex array object
-    GLuint  vertexBuffer;
-    GLuint  textureBuffer;
-    GLuint  colourBuffer;
-    GLuint  vertexArray;
-    GLsizei elementCount;
+    string distanceVertexSource = LoadSource("shaders/distanceVertex.glsl");
+    string distanceFragmentSource = LoadSource("shaders/distanceFragment.glsl");
     
-    // initialize object names to zero (OpenGL reserved value)
-    Geometry() : vertexBuffer(0), colourBuffer(0), vertexArray(0), elementCount(0)
-    {}
-};
-
-bool InitializeVAO(Geometry *geometry){
-    
-    const GLuint VERTEX_INDEX = 0;
-    const GLuint COLOUR_INDEX = 1;
-    
-    glEnable(GL_PROGRAM_POINT_SIZE);
-    
-    //Generate Vertex Buffer Objects
-    // create an array buffer object for storing our vertices
-    glGenBuffers(1, &geometry->vertexBuffer);
-    
-    // create another one for storing our colours
-    glGenBuffers(1, &geometry->colourBuffer);
-    
-    //Set up Vertex Array Object
-    // create a vertex array object encapsulating all our vertex attributes
-    glGenVertexArrays(1, &geometry->vertexArray);
-    glBindVertexArray(geometry->vertexArray);
-    
-    // associate the position array with the vertex array object
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
-    glVertexAttribPointer(
-                          VERTEX_INDEX,         //Attribute index
-                          2,                    //# of components
-                          GL_FLOAT,             //Type of component
-                          GL_FALSE,             //Should be normalized?
-                          0,                    //Stride - can use 0 if tightly packed
-                          0);                   //Offset to first element
-    glEnableVertexAttribArray(VERTEX_INDEX);
-    
-    // associate the colour array with the vertex array object
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
-    glVertexAttribPointer(
-                          COLOUR_INDEX,         //Attribute index
-                          3,                    //# of components
-                          GL_FLOAT,             //Type of component
-                          GL_FALSE,             //Should be normalized?
-                          0,                    //Stride - can use 0 if tightly packed
-                          0);                   //Offset to first element
-    glEnableVertexAttribArray(COLOUR_INDEX);
-    
-    // unbind our buffers, resetting to default state
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    if (distanceVertexSource.empty() || distanceFragmentSource.empty()) {
+        return 0;
+    }
     
-    return !CheckGLErrors();
+    const string cacheFile = "shaders/distance.programbinary";
+    vector<string> sources = { distanceVertexSource, distanceFragmentSource };
+    GLuint cached = LoadProgramBinary(cacheFile, sources);
+    if (cached) {
+        return cached;
+    }
+    
+    GLuint vertex = CompileShader(GL_VERTEX_SHADER, distanceVertexSource);
+    GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, distanceFragmentSource);
+    
+    GLuint program = LinkProgram(vertex, fragment, GL_FALSE, GL_FALSE);
+    
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    
+    if (CheckGLErrors()) {
+        return 0;
+    }
+    
+    SaveProgramBinary(program, cacheFile, sources);
+    
+    return program;
 }
 
-// create buffers and fill with geometry data, returning true if successful
-bool LoadGeometry(Geometry *geometry, int elementCount)
+// the tessellation stages of the outline program on their own, capturing
+// the lines they make instead of drawing them
+GLuint initializeCaptureShaders()
 {
-    geometry->elementCount = elementCount;
+    string vertexSource = LoadSource("shaders/vertex.glsl");
+    string tcsSource = LoadSource("shaders/tessControl.glsl");
+    string tesSource = LoadSource("shaders/tessEval.glsl");
     
-    // create an array buffer object for storing our vertices
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * geometry->elementCount, &vertices[0], GL_STATIC_DRAW);
+    if (vertexSource.empty() || tcsSource.empty() || tesSource.empty()) {
+        return 0;
+    }
     
-    // create another one for storing our colours
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * geometry->elementCount, &colours[0], GL_STATIC_DRAW);
+    // the captured outputs are part of the linked program
+    const string cacheFile = "shaders/capture.programbinary";
+    vector<string> sources = { vertexSource, tcsSource, tesSource };
+    for (GLsizei i = 0; i < CAPTURE_VARYING_COUNT; i++) {
+        sources.push_back(CAPTURE_VARYINGS[i]);
+    }
+    GLuint cached = LoadProgramBinary(cacheFile, sources);
+    if (cached) {
+        return cached;
+    }
     
-    //Unbind buffer to reset to default state
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GLuint vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint tcs = CompileShader(GL_TESS_CONTROL_SHADER, tcsSource);
+    GLuint tes = CompileShader(GL_TESS_EVALUATION_SHADER, tesSource);
     
-    // check for OpenGL errors and return false if error occurred
-    return !CheckGLErrors();
+    GLuint program = LinkProgram(vertex, GL_FALSE, tcs, tes, CAPTURE_VARYINGS, CAPTURE_VARYING_COUNT);
+    
+    glDeleteShader(vertex);
+    glDeleteShader(tcs);
+    glDeleteShader(tes);
+    
+    if (CheckGLErrors()) {
+        return 0;
+    }
+    
+    SaveProgramBinary(program, cacheFile, sources);
+    
+    return program;
 }
 
-// deallocate geometry-related objects
-void DestroyGeometry(Geometry *geometry)
+// draws the captured lines, coloured like the outline program
+GLuint initializeBakedShaders()
 {
-    // unbind and destroy our vertex array object and associated buffers
-    glBindVertexArray(0);
-    glDeleteVertexArrays(1, &geometry->vertexArray);
-    glDeleteBuffers(1, &geometry->vertexBuffer);
-    glDeleteBuffers(1, &geometry->colourBuffer);
+    string bakedVertexSource = LoadSource("shaders/bakedVertex.glsl");
+    string fragmentSource = LoadSource("shaders/fragment.glsl");
+    
+    if (bakedVertexSource.empty() || fragmentSource.empty()) {
+        return 0;
+    }
+    
+    const string cacheFile = "shaders/baked.programbinary";
+    vector<string> sources = { bakedVertexSource, fragmentSource };
+    GLuint cached = LoadProgramBinary(cacheFile, sources);
+    if (cached) {
+        return cached;
+    }
+    
+    GLuint vertex = CompileShader(GL_VERTEX_SHADER, bakedVertexSource);
+    GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    
+    GLuint program = LinkProgram(vertex, fragment, GL_FALSE, GL_FALSE);
+    
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    
+    if (CheckGLErrors()) {
+        return 0;
+    }
+    
+    SaveProgramBinary(program, cacheFile, sources);
+    
+    return program;
 }
 
 // --------------------------------------------------------------------------
 // Rendering function that draws our scene to the frame buffer
 
-void RenderScene(Geometry *geometry, GLuint program, GLuint pointProgram)
+// the programs drawing each part of the scene
+struct ScenePrograms
+{
+    map<ProgramVariant, ShaderProgram> variants;    // outlines and the overlay
+    ShaderProgram fill;         // stencil-then-cover filled text
+    ShaderProgram distance;     // text from the distance field atlas
+    ShaderProgram capture;      // tessellates curves into a capture
+    ShaderProgram baked;        // draws the captured curves
+};
+
+// The outlines of a static scene, tessellated once and captured: they are
+// drawn from the capture for as long as the geometry, its transform and the
+// frame's scale, shift, flatness and viewport stay the same
+struct CurveBake
+{
+    CapturedCurves capture;
+    const Geometry *geometry;   // what was captured, null if nothing is
+    mat4        transform;
+    FrameUniforms frame;
+    
+    CurveBake() : geometry(0), transform(1.f), frame() {}
+};
+
+// outlines of scenes that don't move are drawn from a capture, unless
+// toggled off to compare
+CurveBake curveBake;
+bool bakeCurves = true;
+
+// compiles every variant the scene and the labels draw with, returning true
+// if successful; without tessellation that is only the overlays
+bool initializeVariants(ScenePrograms *programs)
+{
+    vector<ProgramVariant> variants = { OVERLAY_VARIANT, LABEL_LINES_VARIANT };
+    for (int degree = 0; degree <= 3 && !cpuCurves; degree++) {
+        if (degree == 1) continue;
+        variants.push_back({ degree, true, false, false });
+        variants.push_back({ degree, false, false, false });
+    }
+    if (!cpuCurves) {
+        variants.push_back(LABEL_QUADRATICS_VARIANT);
+        variants.push_back(LABEL_CUBICS_VARIANT);
+    }
+    
+    for (size_t i = 0; i < variants.size(); i++) {
+        ShaderProgram &shader = programs->variants[variants[i]];
+        if (!InitializeProgram(&shader, initializeVariantShaders(variants[i]))) {
+            cout << "Shader variant " << variantName(variants[i]) << " failed to initialize" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns the program specialized for the variant, or the generic one if
+// the variant wasn't compiled
+const ShaderProgram *findVariant(const ScenePrograms *programs, const ProgramVariant &variant)
+{
+    map<ProgramVariant, ShaderProgram>::const_iterator found = programs->variants.find(variant);
+    if (found == programs->variants.end()) {
+        found = programs->variants.find(GENERIC_VARIANT);
+    }
+    return &found->second;
+}
+
+// the outline program specialized for the patches of the geometry
+const ShaderProgram *findOutlineVariant(const ScenePrograms *programs, const Geometry *geometry)
+{
+    ProgramVariant variant = { geometry->patchDegree, geometry->format == COLOURED_VERTICES, false, false };
+    return findVariant(programs, variant);
+}
+
+// the buffers of everything that can be drawn: the demo curves have a
+// colour per control point, while the glyph atlas is kept as 16-bit
+// positions, drawn as coloured instances. Distance field text draws its
+// quads the same way, textured from the distance atlas
+struct SceneGeometry
+{
+    Geometry curves;
+    Geometry text;
+    Geometry distance;
+    Geometry stats;             // the frame time overlay
+};
+
+// fills text with the glyph triangles: the stencil pass counts how often
+// each pixel is wound around (front faces up, back faces down), then the
+// cover pass colours the pixels with a non-zero count, clearing them again
+void RenderFilledText(Geometry *geometry, const mat4 &modelTransform, const ShaderProgram *fillProgram)
+{
+    UseProgram(fillProgram, modelTransform, geometry->positionScale);
+    BindGeometry(geometry);
+    glEnable(GL_STENCIL_TEST);
+    
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glStencilFunc(GL_ALWAYS, 0, 0xff);
+    glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+    glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+    DrawGeometry(geometry, GL_TRIANGLES);
+    
+    // characters that overlap share their pixels, coloured by whichever
+    // cover comes first
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+    DrawGeometry(geometry, GL_TRIANGLE_STRIP);
+    
+    glDisable(GL_STENCIL_TEST);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// draws a quad per character, blending in the coverage the distance field
+// gives each pixel
+void RenderDistanceText(Geometry *geometry, const mat4 &modelTransform, const ShaderProgram *distanceProgram)
+{
+    UseProgram(distanceProgram, modelTransform, geometry->positionScale);
+    BindGeometry(geometry);
+    glBindTexture(distanceTexture.target, distanceTexture.textureID);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    
+    DrawGeometry(geometry, GL_TRIANGLE_STRIP);
+    
+    glDisable(GL_BLEND);
+    glBindTexture(distanceTexture.target, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// returns true if the capture holds the curves of the geometry as they
+// would be tessellated now
+static bool isBakeCurrent(const Geometry *geometry, const mat4 &modelTransform, const FrameUniforms &frame)
+{
+    const FrameUniforms &baked = curveBake.frame;
+    return curveBake.geometry == geometry && curveBake.transform == modelTransform &&
+           baked.viewportSize == frame.viewportSize && baked.scaleBy == frame.scaleBy &&
+           baked.shiftBy == frame.shiftBy && baked.flatness == frame.flatness;
+}
+
+// draws the patches of the geometry from the capture, tessellating them
+// into it first if it is out of date; returns false if they can't be
+// captured, so they have to be drawn as patches after all
+static bool renderBakedCurves(Geometry *geometry, const mat4 &modelTransform, const ScenePrograms *programs,
+                              const FrameUniforms &frame)
+{
+    if (!programs->capture.program || !programs->baked.program) {
+        return false;
+    }
+    
+    if (!isBakeCurrent(geometry, modelTransform, frame)) {
+        UseProgram(&programs->capture, modelTransform, geometry->positionScale);
+        BindGeometry(geometry);
+        if (!CaptureCurves(&curveBake.capture, geometry)) {
+            curveBake.geometry = 0;
+            return false;
+        }
+        curveBake.geometry = geometry;
+        curveBake.transform = modelTransform;
+        curveBake.frame = frame;
+    }
+    
+    UseProgram(&programs->baked, mat4(1.f), 1.f);
+    DrawCapturedCurves(&curveBake.capture);
+    return true;
+}
+
+void RenderScene(Geometry *geometry, const mat4 &modelTransform, const ScenePrograms *programs,
+                 const FrameUniforms &frame)
 {
     // clear screen to a dark grey colour
     glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    
+    // text drawn filled or from distance fields takes a single pass,
+    // timed in place of the patches
+    if (fontLoaded != NO_FONT && textObject.style == FILLED_TEXT) {
+        ProfileScope pass(&profiler, PROFILE_PATCHES);
+        RenderFilledText(geometry, modelTransform, &programs->fill);
+        CheckDrawErrors();
+        return;
+    }
+    if (fontLoaded != NO_FONT && textObject.style == DISTANCE_FIELD_TEXT) {
+        ProfileScope pass(&profiler, PROFILE_PATCHES);
+        RenderDistanceText(geometry, modelTransform, &programs->distance);
+        CheckDrawErrors();
+        return;
+    }
     
     // bind our shader program and the vertex array object containing our
-    // scene geometry, then tell OpenGL to draw our geometry
+    // scene geometry, then tell OpenGL to draw our geometry; state shared
+    // by all programs is already in the FrameUniforms block. Scenes that
+    // don't move are drawn from their capture instead
+    BeginProfileSection(&profiler, PROFILE_PATCHES);
+    bool isStatic = fontLoaded == NO_FONT || !textIsScrolling;
+    if (cpuCurves) {
+        // the curves were flattened into the lines drawn below
+        BindGeometry(geometry);
+    } else if (bakeCurves && isStatic && renderBakedCurves(geometry, modelTransform, programs, frame)) {
+        BindGeometry(geometry);
+    } else {
+        UseProgram(findOutlineVariant(programs, geometry), modelTransform, geometry->positionScale);
+        BindGeometry(geometry);
+        DrawGeometry(geometry, GL_PATCHES);
+    }
+    EndProfileSection(&profiler, PROFILE_PATCHES);
+    
+    // then everything drawn without tessellation as one overlay batch,
+    // under a single bind of the point program: the control polygons of the
+    // figures, or the straight segments of text, and then the control points
+    // on top of them, only if drawing the figures
+    BeginProfileSection(&profiler, PROFILE_LINES);
+    UseProgram(findVariant(programs, OVERLAY_VARIANT), modelTransform, geometry->positionScale);
+    DrawGeometry(geometry, GL_LINES);
+    if (fontLoaded == NO_FONT) {
+        DrawGeometry(geometry, GL_POINTS);
+    }
+    EndProfileSection(&profiler, PROFILE_LINES);
+    
+    // reset state to default (no shader or geometry bound)
+    glBindVertexArray(0);
+    glUseProgram(0);
+    
+    // check for an report any OpenGL errors
+    CheckDrawErrors();
+}
 
-    glUseProgram(program);
-    glBindVertexArray(geometry->vertexArray);
+// outlines the frame time overlay in the top left corner, over the scene;
+// it is placed in clip space, so the scene's scale and shift are undone
+void RenderStats(Geometry *geometry, const ScenePrograms *programs, GLuint frameUniformBuffer,
+                 FrameUniforms frame)
+{
+    frame.scaleBy = 1.f;
+    frame.shiftBy = 0.f;
+    LoadFrameUniforms(frameUniformBuffer, frame);
+    
+    const mat4 &modelTransform = statsLines[0].transform;
+    BindGeometry(geometry);
+    if (!cpuCurves) {
+        UseProgram(findOutlineVariant(programs, geometry), modelTransform, geometry->positionScale);
+        DrawGeometry(geometry, GL_PATCHES);
+    }
     
-    unsigned int isQuadratic = glGetUniformLocation(program, "quadratic");
-    glUniform1f(isQuadratic, quadraticBezier);
+    UseProgram(findVariant(programs, OVERLAY_VARIANT), modelTransform, geometry->positionScale);
+    DrawGeometry(geometry, GL_LINES);
     
-    unsigned int isCubic = glGetUniformLocation(program, "cubic");
-    glUniform1f(isCubic, cubicBezier);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    CheckDrawErrors();
+}
+
+// outlines every label of the label scene, after bringing the ones that
+// changed up to date: each section of the arena is drawn for all the labels
+// in a single multi-draw. The labels are placed in clip space, and the
+// arena's vertices already have their transforms applied
+void RenderLabels(const ScenePrograms *programs, GLuint frameUniformBuffer, FrameUniforms frame)
+{
+    BeginProfileSection(&profiler, PROFILE_LAYOUT);
+    updateLabels();
+    EndProfileSection(&profiler, PROFILE_LAYOUT);
     
-    unsigned int isPoints = glGetUniformLocation(program, "drawControlPoints");
-    glUniform1f(isPoints, drawPoints);
+    {
+        ProfileScope upload(&profiler, PROFILE_UPLOAD);
+        if (!UpdateSceneArena(&labelScene)) {
+            cout << "Failed to update the label scene" << endl;
+        }
+    }
     
-    unsigned int scaleIs = glGetUniformLocation(program, "scaleBy");
-    glUniform1f(scaleIs, scaleBy);
+    frame.scaleBy = 1.f;
+    frame.shiftBy = 0.f;
+    LoadFrameUniforms(frameUniformBuffer, frame);
     
-    unsigned int shiftIs = glGetUniformLocation(program, "shiftBy");
-    glUniform1f(shiftIs, shiftBy);
+    glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    
+    // quadratics and cubics have programs of their own, so neither reads
+    // its degree from the tags
+    // the labels' transforms are applied per object, from the arena
+    Geometry *geometry = &labelScene.geometry;
+    BindSceneArena(&labelScene);
+    BeginProfileSection(&profiler, PROFILE_PATCHES);
+    if (!cpuCurves) {
+        UseProgram(findVariant(programs, LABEL_QUADRATICS_VARIANT), mat4(1.f), geometry->positionScale);
+        DrawSceneSection(&labelScene, SCENE_QUADRATICS, GL_PATCHES);
+        UseProgram(findVariant(programs, LABEL_CUBICS_VARIANT), mat4(1.f), geometry->positionScale);
+        DrawSceneSection(&labelScene, SCENE_CUBICS, GL_PATCHES);
+    }
+    EndProfileSection(&profiler, PROFILE_PATCHES);
     
-    glDrawArrays(GL_PATCHES, 0, geometry->elementCount);
+    BeginProfileSection(&profiler, PROFILE_LINES);
+    UseProgram(findVariant(programs, LABEL_LINES_VARIANT), mat4(1.f), geometry->positionScale);
+    DrawSceneSection(&labelScene, SCENE_LINES, GL_LINES);
+    EndProfileSection(&profiler, PROFILE_LINES);
+    FenceSceneArena(&labelScene);
     
-    // reset state to default (no shader or geometry bound)
     glBindVertexArray(0);
     glUseProgram(0);
-    
-    // draw points and polygon lines only if drawing the figures
+    CheckDrawErrors();
+}
+
+// brings the geometry of the figures or the text up to date, uploading only
+// what changed since the last frame, then draws it
+void drawScene(SceneGeometry *scene, const ScenePrograms *programs, GLuint frameUniformBuffer,
+               const FrameUniforms &frame)
+{
+    Geometry *geometry = &scene->text;
     if (fontLoaded == NO_FONT) {
-        glUseProgram(pointProgram);
-        glBindVertexArray(geometry->vertexArray);
-        unsigned int scaleIsPoint = glGetUniformLocation(pointProgram, "scaleBy");
-        glUniform1f(scaleIsPoint, scaleBy);
-        
-        unsigned int shiftIsPoint = glGetUniformLocation(pointProgram, "shiftBy");
-        glUniform1f(shiftIsPoint, shiftBy);
-        
-        glDrawArrays(GL_POINTS, 0, geometry->elementCount);
-        
-        glBindVertexArray(0);
-        glUseProgram(0);
-        
-        glUseProgram(pointProgram);
-        glBindVertexArray(geometry->vertexArray);
-        unsigned int scaleIsPointLines = glGetUniformLocation(pointProgram, "scaleBy");
-        glUniform1f(scaleIsPointLines, scaleBy);
-        
-        unsigned int shiftIsPointLines = glGetUniformLocation(pointProgram, "shiftBy");
-        glUniform1f(shiftIsPointLines, shiftBy);
-        
-        glDrawArrays(GL_LINES, 0, geometry->elementCount);
-        
-        glBindVertexArray(0);
-        glUseProgram(0);
+        geometry = &scene->curves;
+        if (curvesDirty) {
+            ProfileScope upload(&profiler, PROFILE_UPLOAD);
+            curveBake.geometry = 0;
+            if (!LoadGeometry(geometry, vertices, colours, degrees) ||
+                !LoadBatches(geometry, curveBatches)) {
+                cout << "Failed to load geometry" << endl;
+            }
+            curvesDirty = false;
+        }
+    } else {
+        if (textObject.style == DISTANCE_FIELD_TEXT) {
+            geometry = &scene->distance;
+        }
+    
+        BeginProfileSection(&profiler, PROFILE_LAYOUT);
+        bool laidOut = updateText(&textObject, &glyphAtlas);
+        EndProfileSection(&profiler, PROFILE_LAYOUT);
+    
+        if (laidOut) {
+            ProfileScope upload(&profiler, PROFILE_UPLOAD);
+            curveBake.geometry = 0;
+            if (glyphAtlas.dirty) {
+                if (!LoadGeometry(&scene->text, glyphAtlas.vertices, vector<vec3>(), glyphAtlas.tags)) {
+                    cout << "Failed to load geometry" << endl;
+                }
+                glyphAtlas.dirty = false;
+            }
+            if (distanceAtlas.dirty) {
+                const DistanceFieldAtlas &field = distanceAtlas.field;
+                if (!LoadGeometry(&scene->distance, distanceAtlas.vertices) ||
+                    !LoadTextureCoords(&scene->distance, distanceAtlas.textureCoords) ||
+                    !InitializeTexture(&distanceTexture, field.Pixels(), field.Width(), field.Height(), 1)) {
+                    cout << "Failed to load distance field atlas" << endl;
+                }
+                distanceBytesUploaded += size_t(field.Width()) * field.Height();
+                distanceAtlas.dirty = false;
+            }
+            if (!LoadInstances(geometry, textObject.instances, textObject.batches)) {
+                cout << "Failed to load geometry" << endl;
+            }
+        }
     }
     
-    // check for an report any OpenGL errors
-    CheckGLErrors();
+    LoadFrameUniforms(frameUniformBuffer, frame);
+    
+    // only the characters on screen are drawn, so long scrolling text costs
+    // no more than what is visible of it
+    mat4 modelTransform = (fontLoaded == NO_FONT) ? mat4(1.0f) : textObject.transform;
+    if (fontLoaded != NO_FONT && !textObject.instances.empty()) {
+        cullText(&textObject, modelTransform, frame);
+        if (!SetVisibleBatches(geometry, textObject.visibleBatches)) {
+            cout << "Failed to cull text" << endl;
+        }
+    }
+    
+    // call function to draw our scene
+    RenderScene(geometry, modelTransform, programs, frame);
 }
 
-mat4 translateText(mat4 transform)
+// draws whatever is shown into the bound framebuffer: the label scene, or
+// else the figures or the text, then the overlay on top
+void drawFrame(SceneGeometry *scene, const ScenePrograms *programs, GLuint frameUniformBuffer,
+               int framebufferWidth, int framebufferHeight)
 {
-    return translate(transform, vec3(0.1, 0.0f, 0.0f));
+    BeginProfileFrame(&profiler);
+    
+    if (textIsScrolling) {
+        scrollText();
+    }
+    
+    adoptLoadedFonts(&textObject);
+    
+    // the state shared by all programs for this frame
+    FrameUniforms frame = {};
+    frame.viewportSize = vec2(framebufferWidth, framebufferHeight);
+    frame.scaleBy = scaleBy;
+    frame.shiftBy = shiftBy;
+    frame.flatness = tessFlatness;
+    
+    if (showLabels) {
+        RenderLabels(programs, frameUniformBuffer, frame);
+    } else {
+        drawScene(scene, programs, frameUniformBuffer, frame);
+    }
+    
+    EndProfileFrame(&profiler);
+    
+    // the overlay isn't part of the frame it measures
+    if (showStats) {
+        if (updateStats()) {
+            vector<GeometryInstance> instances;
+            vector<GeometryBatch> batches;
+            mergeText(statsLines, PROFILE_SECTIONS + 1, &instances, &batches);
+            if ((statsAtlas.dirty &&
+                 !LoadGeometry(&scene->stats, statsAtlas.vertices, vector<vec3>(), statsAtlas.tags)) ||
+                !LoadInstances(&scene->stats, instances, batches)) {
+                cout << "Failed to load frame time overlay" << endl;
+            }
+            statsAtlas.dirty = false;
+        }
+        RenderStats(&scene->stats, programs, frameUniformBuffer, frame);
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -326,9 +995,23 @@ void ErrorCallback(int error, const char* description)
     cout << description << endl;
 }
 
+// asks for a frame when the window is resized, or its contents are lost
+void RefreshCallback(GLFWwindow* window)
+{
+    redrawNeeded = true;
+}
+
+void FramebufferSizeCallback(GLFWwindow* window, int width, int height)
+{
+    redrawNeeded = true;
+}
+
 // handles keyboard input events
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+    // whatever a key changes is shown in the next frame
+    redrawNeeded = true;
+    
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
         
         glfwSetWindowShouldClose(window, GL_TRUE);
@@ -341,12 +1024,12 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
         bezierType = QUADRATIC;
         addVertices(bezierType);
         addColours();
-        cubicBezier = 0.f;
-        quadraticBezier = 1.f;
+        padPatches(bezierType);
+        addControlPolygon(bezierType);
+        curvesDirty = true;
         scaleBy = 0.35f;
         shiftBy = 0.f;
         textIsScrolling = false;
-        glPatchParameteri(GL_PATCH_VERTICES, 3);
         
     } else if (key == GLFW_KEY_W && action == GLFW_PRESS) {
         // For fish
@@ -356,12 +1039,12 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
         bezierType = CUBIC;
         addVertices(bezierType);
         addColours();
-        cubicBezier = 1.f;
-        quadraticBezier = 0.f;
+        padPatches(bezierType);
+        addControlPolygon(bezierType);
+        curvesDirty = true;
         scaleBy = 0.125f;
         shiftBy = -4.5f;
         textIsScrolling = false;
-        glPatchParameteri(GL_PATCH_VERTICES, 4);
         
     } else if (key == GLFW_KEY_A && action == GLFW_PRESS) {
         // For inconsolata
@@ -422,147 +1105,834 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
             textScrollSpeed -= 0.01;
         }
         
-    } else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+    } else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        
+        textScrollSpeed += 0.01;
+        
+    } else if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        
+        // cycle through outlined, filled and distance field text
+        setTextStyle(&textObject, TextStyle((textObject.style + 1) % 3));
+        
+    } else if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        
+        // show or hide frame times; a dump keeps them being measured
+        showStats = !showStats;
+        statsUpdated = 0.0;
+        SetProfiling(&profiler, showStats || profiler.dump.is_open());
+        
+    } else if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        
+        // draw static outlines from their capture, or tessellate every frame
+        bakeCurves = !bakeCurves;
+        curveBake.geometry = 0;
+        
+    } else if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        
+        // show or hide the label scene, laid out the first time it's shown
+        showLabels = !showLabels;
+        if (showLabels && labels.empty()) {
+            createLabels(labelCount);
+        }
+        
+    }
+}
+
+void loadLoraBoldItalic()
+{
+    fontShiftBy = -3.f;
+    fontScaleBy = 0.25;
+    
+    setTextFont(&textObject, LORA_BOLD_ITALIC_FILE);
+    setTextString(&textObject, "Farzam Noori");
+    setTextPlacement(&textObject, fontShiftBy, fontYShiftBy, fontScaleBy);
+    
+    scaleBy = 1;
+    shiftBy = 0;
+}
+
+void loadInconsolata()
+{
+    string toPass;
+    
+    if (textIsScrolling) {
+        toPass = "The quick brown fox jumps over the lazy dog.";
+    } else {
+        toPass = "Farzam Noori";
+        fontShiftBy = -2.7f;
+        fontScaleBy = 0.30;
+    }
+    
+    setTextFont(&textObject, SOURCE_SANS_FILE);
+    setTextString(&textObject, toPass);
+    setTextPlacement(&textObject, fontShiftBy, fontYShiftBy, fontScaleBy);
+    
+    scaleBy = 1;
+    shiftBy = 0;
+}
+
+void loadQarmicSans()
+{
+    string toPass;
+    
+    if (textIsScrolling) {
+        toPass = "The quick brown fox jumps over the lazy dog.";
+    } else {
+        toPass = "Farzam Noori";
+        fontShiftBy = -3.3f;
+        fontScaleBy = 0.25;
+    }
+    
+    setTextFont(&textObject, QARMIC_SANS_FILE);
+    setTextString(&textObject, toPass);
+    setTextPlacement(&textObject, fontShiftBy, fontYShiftBy, fontScaleBy);
+    
+    scaleBy = 1;
+    shiftBy = 0;
+}
+
+void loadAlexBrush()
+{
+    string toPass;
+    
+    if (textIsScrolling) {
+        toPass = "The quick brown fox jumps over the lazy dog.";
+    } else {
+        toPass = "Farzam Noori";
+        fontShiftBy = -2.5f;
+        fontScaleBy = 0.30;
+    }
+    
+    setTextFont(&textObject, ALEX_BRUSH_FILE);
+    setTextString(&textObject, toPass);
+    setTextPlacement(&textObject, fontShiftBy, fontYShiftBy, fontScaleBy);
+    
+    scaleBy = 1;
+    shiftBy = 0;
+}
+
+// moves the scrolling text along by the time since it last moved, wrapping
+// around at the end, so its speed doesn't depend on the frame rate; only the
+// text's transform changes, so nothing is laid out or uploaded
+void scrollText()
+{
+    // a step is at most a few frames, so text doesn't jump after a pause
+    double now = glfwGetTime();
+    float frames = float(std::min(now - scrollUpdated, 0.1) * 60.0);
+    scrollUpdated = now;
+    
+    if (fontShiftBy > resetScroll) {
+        fontShiftBy -= 0.1*textScrollSpeed*frames;
+    } else {
+        fontShiftBy = -0.3;
+    }
+    
+    setTextPlacement(&textObject, fontShiftBy, fontYShiftBy, fontScaleBy);
+}
+
+// --------------------------------------------------------------------------
+// Retained text object support functions
+
+void setTextString(TextObject *textObject, string_view text)
+{
+    if (textObject->text != text) {
+        textObject->text = text;
+        textObject->dirty = true;
+    }
+}
+
+// switches the text to a font once its glyphs are decoded; until then it
+// keeps drawing in the font it had
+void setTextFont(TextObject *textObject, const string &fontFile)
+{
+    // going back to the current font cancels a switch that is still loading
+    if (textObject->fontFile == fontFile) {
+        textObject->pendingFont.clear();
+        return;
+    }
+    
+    requestFont(fontFile);
+    if (findLoadedFont(fontFile)) {
+        textObject->fontFile = fontFile;
+        textObject->pendingFont.clear();
+        textObject->dirty = true;
+    } else {
+        textObject->pendingFont = fontFile;
+    }
+}
+
+void setTextPlacement(TextObject *textObject, float shiftBy, float yShiftBy, float scaleBy)
+{
+    if (textObject->yShiftBy != yShiftBy || textObject->scaleBy != scaleBy) {
+        textObject->yShiftBy = yShiftBy;
+        textObject->scaleBy = scaleBy;
+        textObject->dirty = true;
+    }
+    
+    // the horizontal shift is in EM units, so it scales with the text
+    textObject->transform = translateText(mat4(1.0f), shiftBy * scaleBy);
+}
+
+void setTextColour(TextObject *textObject, vec3 colour)
+{
+    if (textObject->colour != colour) {
+        textObject->colour = colour;
+        textObject->dirty = true;
+    }
+}
+
+void setTextStyle(TextObject *textObject, TextStyle style)
+{
+    // only switching to or from distance fields changes the layout
+    if ((textObject->style == DISTANCE_FIELD_TEXT) != (style == DISTANCE_FIELD_TEXT)) {
+        textObject->dirty = true;
+    }
+    textObject->style = style;
+}
+
+// lays the text out again if it changed, returning true if its instances
+// (and maybe the atlas) need to be uploaded; outlines and filled text come
+// from the given atlas
+bool updateText(TextObject *textObject, GlyphAtlas *atlas)
+{
+    if (!textObject->dirty || !textObject->pendingFont.empty()) {
+        return false;
+    }
+    
+    textObject->instances.clear();
+    textObject->batches.clear();
+    textObject->batchBounds.clear();
+    textObject->dirty = false;
+    
+    if (textObject->text.empty()) {
+        return true;
+    }
+    
+    // lay out from the glyphs decoded in the background, unless some are
+    // missing from its character set; those are decoded here. Either way
+    // the run is kept, for the next time the string is shown
+    textObject->run = shapedRuns.Find(textObject->fontFile, textObject->text);
+    if (!textObject->run) {
+        shared_ptr<GlyphRun> run(new GlyphRun());
+        const LoadedFont *font = findLoadedFont(textObject->fontFile);
+        if (!(font && font->LayOut(textObject->text, run.get())) &&
+            !glyphService.Decode(textObject->fontFile, textObject->text, run.get())) {
+            cout << "Failed to load '" << textObject->fontFile << "' file" << endl;
+            return true;
+        }
+        shapedRuns.Insert(textObject->fontFile, textObject->text, run);
+        textObject->run = run;
+    }
+    
+    insertString(textObject, atlas);
+    
+    return true;
+}
+
+// starts loading a font in the background, unless it was already asked for
+void requestFont(const string &fontFile)
+{
+    if (loadedFonts.find(fontFile) == loadedFonts.end()) {
+        loadedFonts[fontFile] = shared_ptr<const LoadedFont>();
+        fontLoader.Load(fontFile);
+    }
+}
+
+// returns a font whose glyphs are decoded, or null if it is still loading
+// or wasn't asked for; only requestFont adds entries
+const LoadedFont *findLoadedFont(string_view fontFile)
+{
+    map<string, shared_ptr<const LoadedFont>, less<> >::const_iterator font = loadedFonts.find(fontFile);
+    return font != loadedFonts.end() ? font->second.get() : 0;
+}
+
+// takes the fonts the loader has finished, switching the text to its new
+// font if that is one of them
+void adoptLoadedFonts(TextObject *textObject)
+{
+    vector<shared_ptr<const LoadedFont> > ready;
+    if (!fontLoader.Poll(&ready)) {
+        return;
+    }
+    
+    for (const shared_ptr<const LoadedFont> &font : ready) {
+        loadedFonts[font->fontFile] = font;
+        reserveAtlases(*font);
+    }
+    
+    if (!textObject->pendingFont.empty() && findLoadedFont(textObject->pendingFont)) {
+        textObject->fontFile = textObject->pendingFont;
+        textObject->pendingFont.clear();
+        textObject->dirty = true;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Main loop scheduling support functions
+
+// returns true if anything shown changed since the last frame: input or the
+// window asked for one, the geometry shown is dirty, a font the text waits
+// for is in, or the overlay's numbers are due
+bool isFrameNeeded()
+{
+    adoptLoadedFonts(&textObject);
+    
+    // text waiting for its font keeps its old layout until it arrives
+    bool textDirty = fontLoaded != NO_FONT && textObject.dirty && textObject.pendingFont.empty();
+    bool curvesChanged = fontLoaded == NO_FONT && curvesDirty;
+    bool statsDue = showStats && glfwGetTime() - statsUpdated >= STATS_REFRESH_INTERVAL;
+    return redrawNeeded || textDirty || curvesChanged || statsDue;
+}
+
+// returns true if frames are drawn continuously, for scrolling text or the
+// counting labels
+bool isAnimating()
+{
+    return (textIsScrolling && fontLoaded != NO_FONT) || showLabels;
+}
+
+// sets the swap interval that paces frames at the given rate, a whole
+// number of refreshes of the display, and returns it; it is 0 if no whole
+// number is within a tenth of the rate (or the rate is 0), leaving pacing
+// to the main loop
+int chooseSwapInterval(int frameRate)
+{
+    int interval = 0;
+    const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    if (frameRate > 0 && mode && mode->refreshRate > 0) {
+        int refreshes = std::max(1, int(double(mode->refreshRate) / frameRate + 0.5));
+        double paced = double(mode->refreshRate) / refreshes;
+        if (std::abs(paced - frameRate) <= 0.1 * frameRate) {
+            interval = refreshes;
+        }
+    }
+    glfwSwapInterval(interval);
+    return interval;
+}
+
+// --------------------------------------------------------------------------
+// Frame time overlay support functions
+
+// a time in milliseconds for the overlay, or a dash while it isn't known
+static string formatTime(double milliseconds)
+{
+    if (milliseconds < 0.0) {
+        return "-";
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f", milliseconds);
+    return text;
+}
+
+// an average count for the overlay, to one decimal
+static string formatCount(double count)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.1f", count);
+    return text;
+}
+
+// refreshes the overlay's lines with the averaged frame times a few times
+// a second, returning true if it has to be uploaded again
+bool updateStats()
+{
+    const float lineScale = 0.05f;
+    
+    double now = glfwGetTime();
+    bool refresh = now - statsUpdated >= STATS_REFRESH_INTERVAL;
+    if (refresh) {
+        statsUpdated = now;
+    }
+    
+    const FrameProfile &times = profiler.average;
+    bool laidOut = false;
+    for (int i = 0; i <= PROFILE_SECTIONS; i++) {
+        TextObject *line = &statsLines[i];
+        if (refresh) {
+            string text = "frame  " + formatTime(times.frameCpu) + " ms  " +
+                          formatCount(times.allocations) + " allocs";
+            if (i > 0) {
+                text = string(ProfileSectionName(ProfileSection(i - 1))) + "  cpu " +
+                       formatTime(times.cpu[i - 1]) + "  gpu " + formatTime(times.gpu[i - 1]) + " ms";
+            }
+            setTextFont(line, SOURCE_SANS_FILE);
+            setTextString(line, text);
+            setTextColour(line, vec3(1.f, 0.85f, 0.3f));
+            setTextPlacement(line, -0.97f / lineScale, (0.9f - 0.07f * i) / lineScale, lineScale);
+        }
+        laidOut = updateText(line, &statsAtlas) || laidOut;
+    }
+    return laidOut;
+}
+
+// gathers the instances and batches of text objects drawn from the same
+// atlas, and with the same transform, into a single upload
+void mergeText(const TextObject *textObjects, int count, vector<GeometryInstance> *instances,
+               vector<GeometryBatch> *batches)
+{
+    for (int i = 0; i < count; i++) {
+        const TextObject &text = textObjects[i];
+        GLint firstInstance = instances->size();
+        instances->insert(instances->end(), text.instances.begin(), text.instances.end());
+        for (GeometryBatch batch : text.batches) {
+            batch.firstInstance += firstInstance;
+            batches->push_back(batch);
+        }
+    }
+}
+
+// returns true if the box, placed by the instance and transforms as the
+// vertex shaders place its glyph, overlaps the viewport
+static bool isOnScreen(const MyBounds &bounds, const GeometryInstance &instance, const mat4 &modelTransform,
+                       const FrameUniforms &frame)
+{
+    // every corner, as the model transform may rotate the text
+    vec2 lower(FLT_MAX), upper(-FLT_MAX);
+    for (int k = 0; k < 4; k++) {
+        vec2 corner((k & 1) ? bounds.xMax : bounds.xMin, (k & 2) ? bounds.yMax : bounds.yMin);
+        corner = (corner + instance.offset) * instance.scale;
+        corner = vec2(modelTransform * vec4(corner, 0.f, 1.f));
+        corner = (corner + frame.shiftBy) * frame.scaleBy;
+        lower = min(lower, corner);
+        upper = max(upper, corner);
+    }
+    return upper.x >= -1.f && lower.x <= 1.f && upper.y >= -1.f && lower.y <= 1.f;
+}
+
+// cuts the batches of the text down to the instances on screen this frame;
+// a batch whose visible instances aren't contiguous becomes a batch for
+// each run of them, and one with none is left out
+void cullText(TextObject *textObject, const mat4 &modelTransform, const FrameUniforms &frame)
+{
+    vector<GeometryBatch> &visible = textObject->visibleBatches;
+    visible.clear();
+    
+    for (size_t b = 0; b < textObject->batches.size(); b++) {
+        const GeometryBatch &batch = textObject->batches[b];
+        GeometryBatch run = batch;
+        run.instanceCount = 0;
+        
+        for (GLint i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++) {
+            if (isOnScreen(textObject->batchBounds[b], textObject->instances[i], modelTransform, frame)) {
+                if (run.instanceCount == 0) run.firstInstance = i;
+                run.instanceCount++;
+            } else if (run.instanceCount > 0) {
+                visible.push_back(run);
+                run.instanceCount = 0;
+            }
+        }
+        if (run.instanceCount > 0) {
+            visible.push_back(run);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// Label scene support functions
+
+// outlines the label's value into labelShape, in EM units from its first
+// pen position: curves as padded patches of their degree, and straight
+// segments as lines, or everything as lines without tessellation. Returns
+// false if its font isn't in yet.
+bool buildLabelShape(const Label &label)
+{
+    map<string, shared_ptr<const LoadedFont>, less<> >::const_iterator font = loadedFonts.find(label.fontFile);
+    char text[16];
+    snprintf(text, sizeof(text), "%d", label.value);
+    if (font == loadedFonts.end() || !font->second || !font->second->LayOut(text, &labelRun)) {
+        return false;
+    }
+    
+    ClearSceneShape(&labelShape);
+    labelShape.colour = label.colour;
+    for (size_t i = 0; i < labelRun.glyphs.size(); i++) {
+        const MyGlyph &myGlyph = labelRun.glyphs[i];
+        vec2 pen(labelRun.pens[i], 0.f);
         
-        textScrollSpeed += 0.01;
+        for (int j = 0; j < myGlyph.segmentCount; j++) {
+            const MySegmentEntry &mySegment = myGlyph.segments[j];
+            const MyPoint *controlPoints = &myGlyph.points[mySegment.offset];
+            
+            if (mySegment.degree == 1) {
+                vector<vec2> &lines = labelShape.points[SCENE_LINES];
+                lines.push_back(pen + vec2(controlPoints[0].x, controlPoints[0].y));
+                lines.push_back(pen + vec2(controlPoints[1].x, controlPoints[1].y));
+            } else if (!cpuCurves) {
+                vector<vec2> &patches = labelShape.points[(mySegment.degree == 2) ? SCENE_QUADRATICS : SCENE_CUBICS];
+                for (unsigned int k = 0; k < 4; k++) {
+                    const MyPoint &controlPoint = controlPoints[std::min(k, mySegment.degree)];
+                    patches.push_back(pen + vec2(controlPoint.x, controlPoint.y));
+                }
+            }
+        }
         
+        if (cpuCurves) {
+            labelLines.clear();
+            FlattenGlyph(myGlyph, CPU_GLYPH_TOLERANCE, &labelLines);
+            for (const vec2 &point : labelLines) {
+                labelShape.points[SCENE_LINES].push_back(pen + point);
+            }
+        }
     }
+    return true;
 }
 
-void loadLoraBoldItalic()
+// replaces the labels with a grid of the given number, spread over the demo
+// fonts; each is added to the scene once its font is in
+void createLabels(int count)
 {
-    if (!glyphExtractor.LoadFontFile("fonts/lora/Lora-BoldItalic.ttf")) {
-        cout << "Failed to load 'alex-brush.ttf' file" << endl;
+    for (const Label &label : labels) {
+        if (label.handle != NO_SCENE_OBJECT) {
+            RemoveSceneObject(&labelScene, label.handle);
+        }
     }
-    
-    vertices.clear();
-    colours.clear();
-    bezierType = QUADRATIC;
-    string toPass = "Farzam Noori";
-    fontShiftBy = -3.f;
-    fontScaleBy = 0.25;
-    insertString(toPass);
-    
-    for (int i = 0; i < vertices.size(); i++) {
-        colours.push_back(vec3(1.f, 1.f, 1.f));
+    labels.clear();
+    nextLabel = 0;
+    if (count <= 0) return;
+    
+    const char *fontFiles[] = { LORA_BOLD_ITALIC_FILE, SOURCE_SANS_FILE, QARMIC_SANS_FILE, ALEX_BRUSH_FILE };
+    const vec3 palette[] = { vec3(1.f, 0.85f, 0.3f), vec3(0.4f, 0.8f, 1.f),
+                             vec3(0.6f, 1.f, 0.5f), vec3(1.f, 0.5f, 0.6f) };
+    
+    // cells of the grid fit four digits
+    int columns = int(ceil(sqrt(double(count))));
+    int rows = (count + columns - 1) / columns;
+    float cellWidth = 2.f / columns;
+    float cellHeight = 2.f / rows;
+    float size = std::min(cellWidth / 3.f, 0.7f * cellHeight);
+    
+    labels.reserve(count);
+    for (int i = 0; i < count; i++) {
+        vec2 corner(-1.f + cellWidth * (i % columns + 0.1f), 1.f - cellHeight * (i / columns + 0.8f));
+        
+        Label label;
+        label.handle = NO_SCENE_OBJECT;
+        label.fontFile = fontFiles[i % 4];
+        label.value = i;
+        label.transform = scale(translate(mat4(1.f), vec3(corner, 0.f)), vec3(size, size, 1.f));
+        label.colour = palette[(i / 4) % 4];
+        label.dirty = true;
+        labels.push_back(label);
     }
-    
-    cubicBezier = 0.f;
-    quadraticBezier = 1.f;
-    scaleBy = 1;
-    shiftBy = 0;
-    glPatchParameteri(GL_PATCH_VERTICES, 3);
 }
 
-void loadInconsolata()
+// counts the next label up, then builds the shapes of the labels that
+// changed, so a frame only lays out one label once they're all in
+void updateLabels()
 {
-    if (!glyphExtractor.LoadFontFile("fonts/source-sans-pro/SourceSansPro-SemiboldIt.otf")) {
-        cout << "Failed to load 'Inconsolata.otf' file" << endl;
+    if (!labels.empty()) {
+        Label &counted = labels[nextLabel];
+        counted.value = (counted.value + 1) % 10000;
+        counted.dirty = true;
+        nextLabel = (nextLabel + 1) % labels.size();
     }
     
-    vertices.clear();
-    colours.clear();
-    bezierType = CUBIC;
-    string toPass;
-    
-    if (textIsScrolling) {
-        toPass = "The quick brown fox jumps over the lazy dog.";
-        if (fontShiftBy > resetScroll) {
-            fontShiftBy -= 0.1*textScrollSpeed;
+    for (Label &label : labels) {
+        if (!label.dirty || !buildLabelShape(label)) continue;
+        
+        if (label.handle == NO_SCENE_OBJECT) {
+            label.handle = AddSceneObject(&labelScene, labelShape, label.transform);
         } else {
-            fontShiftBy = -0.3;
+            SetSceneShape(&labelScene, label.handle, labelShape);
         }
-    } else {
-        toPass = "Farzam Noori";
-        fontShiftBy = -2.7f;
-        fontScaleBy = 0.30;
+        label.dirty = false;
     }
+}
+
+// --------------------------------------------------------------------------
+// Benchmark harness: run with --benchmark [frames] to play scripted
+// scenarios through the same key handlers, layout and drawing as the
+// interactive loop, in a hidden window rendering to an offscreen
+// framebuffer, and print how long everything took
+
+struct BenchmarkScenario
+{
+    const char *name;
+    int         key;            // key pressed to set the scene up
+    TextStyle   style;
+    bool        paragraph;      // replace the key's string with a long one
+    bool        rebuild;        // force the text to be laid out every frame
+};
+
+// the value below which the given fraction of the samples fall
+static double percentile(vector<double> samples, double fraction)
+{
+    if (samples.empty()) {
+        return 0.0;
+    }
+    sort(samples.begin(), samples.end());
+    size_t index = std::min(samples.size() - 1, size_t(fraction * samples.size()));
+    return samples[index];
+}
+
+// a paragraph of roughly the given number of characters
+static string benchmarkParagraph(size_t characters)
+{
+    const string sentence = "The quick brown fox jumps over the lazy dog. ";
+    string paragraph;
+    while (paragraph.size() < characters) {
+        paragraph += sentence;
+    }
+    return paragraph;
+}
+
+// times opening a font and extracting the printable characters: cold, with
+// a new extractor reading the file through FreeType; mapped, with a new
+// extractor that may find a glyph cache; and warm, with everything resident
+static void benchmarkFontLoad(const string &fontFile)
+{
+    GlyphExtractor freeType;
+    freeType.SetMapFiles(false);
+    double start = glfwGetTime();
+    freeType.LoadFontFile(fontFile);
+    for (char character : PRINTABLE_ASCII) {
+        freeType.ExtractGlyph(character);
+    }
+    double cold = glfwGetTime() - start;
+    
+    GlyphExtractor mapped;
+    start = glfwGetTime();
+    mapped.LoadFontFile(fontFile);
+    bool cached = mapped.HasGlyphCache();
+    for (char character : PRINTABLE_ASCII) {
+        mapped.ExtractGlyph(character);
+    }
+    double mappedTime = glfwGetTime() - start;
     
-    insertString(toPass);
-    
-    for (int i = 0; i < vertices.size(); i++) {
-        colours.push_back(vec3(1.f, 1.f, 1.f));
+    start = glfwGetTime();
+    mapped.LoadFontFile(fontFile);
+    for (char character : PRINTABLE_ASCII) {
+        mapped.ExtractGlyph(character);
     }
+    double warm = glfwGetTime() - start;
     
-    cubicBezier = 1.f;
-    quadraticBezier = 0.f;
-    scaleBy = 1;
-    shiftBy = 0;
-    glPatchParameteri(GL_PATCH_VERTICES, 4);
+    cout << "  " << setw(52) << left << fontFile << right
+         << " cold " << setw(8) << cold * 1000.0 << " ms"
+         << "  " << setw(10) << PRINTABLE_ASCII.size() / cold << " glyphs/s"
+         << "  mapped " << setw(8) << mappedTime * 1000.0 << " ms" << (cached ? " (glyph cache)" : "")
+         << "  warm " << setw(8) << warm * 1000.0 << " ms" << endl;
 }
 
-void loadQarmicSans()
+// times a new GlyphService decoding a page of strings spread over the given
+// fonts with one worker, then with one per hardware thread: cold, reading
+// the files through FreeType, and mapped, where glyph caches may be found
+static void benchmarkGlyphService(const char *const *fontFiles, int fontCount)
 {
-    if (!glyphExtractor.LoadFontFile("fonts/Qarmic_sans_Abridged.ttf")) {
-        cout << "Failed to load 'alex-brush.ttf' file" << endl;
+    const int STRINGS = 64;
+    vector<GlyphRun> runs(STRINGS);
+    vector<GlyphJob> jobs;
+    for (int i = 0; i < STRINGS; i++) {
+        // every printable character, starting from a different one
+        size_t start = i % PRINTABLE_ASCII.size();
+        GlyphJob job = { fontFiles[i % fontCount], PRINTABLE_ASCII.substr(start) + PRINTABLE_ASCII.substr(0, start),
+                         &runs[i], 0 };
+        jobs.push_back(job);
     }
     
-    vertices.clear();
-    colours.clear();
-    bezierType = QUADRATIC;
-    string toPass;
-    
-    if (textIsScrolling) {
-        toPass = "The quick brown fox jumps over the lazy dog.";
-        if (fontShiftBy > resetScroll) {
-            fontShiftBy -= 0.1*textScrollSpeed;
-        } else {
-            fontShiftBy = -0.3;
+    unsigned int threads = GlyphService().WorkerCount();
+    cout << "  " << STRINGS << " strings in " << fontCount << " fonts:";
+    for (int mapped = 0; mapped < 2; mapped++) {
+        double times[2];
+        for (int parallel = 0; parallel < 2; parallel++) {
+            GlyphService service(parallel ? threads : 1);
+            service.SetMapFiles(mapped != 0);
+            double start = glfwGetTime();
+            service.Run(jobs);
+            times[parallel] = glfwGetTime() - start;
         }
-    } else {
-        toPass = "Farzam Noori";
-        fontShiftBy = -3.3f;
-        fontScaleBy = 0.25;
+        cout << (mapped ? "  mapped " : " cold ") << "1 worker " << setw(8) << times[0] * 1000.0 << " ms, "
+             << threads << " workers " << setw(8) << times[1] * 1000.0 << " ms"
+             << " (x" << times[0] / times[1] << ")";
     }
+    cout << endl;
+}
+
+// plays one scenario for the given number of frames, after waiting for its
+// font to load, and prints its frame times and upload volume
+static void runScenario(GLFWwindow *window, const BenchmarkScenario &scenario, int frames,
+                        SceneGeometry *scene, const ScenePrograms *programs, GLuint frameUniformBuffer,
+                        int width, int height)
+{
+    KeyCallback(window, scenario.key, 0, GLFW_PRESS, 0);
+    if (scenario.paragraph) {
+        setTextString(&textObject, benchmarkParagraph(4000));
+    }
+    setTextStyle(&textObject, scenario.style);
+    
+    // the first frames wait for the font loader; they're timed as set-up
+    double start = glfwGetTime();
+    do {
+        drawFrame(scene, programs, frameUniformBuffer, width, height);
+        glFinish();
+    } while (!textObject.pendingFont.empty() && glfwGetTime() - start < 10.0);
+    double setUp = glfwGetTime() - start;
+    
+    vector<GLuint> queries(frames);
+    glGenQueries(frames, queries.data());
+    vector<double> cpuTimes;
+    cpuTimes.reserve(frames);
+    size_t uploadedBefore = GeometryBytesUploaded() + distanceBytesUploaded;
+    unsigned long allocations = 0;
+    
+    for (int i = 0; i < frames; i++) {
+        if (scenario.rebuild) {
+            setTextColour(&textObject, vec3(1.f, 1.f, (i % 2) ? 1.f : 0.9f));
+        }
     
-    insertString(toPass);
-    
-    for (int i = 0; i < vertices.size(); i++) {
-        colours.push_back(vec3(1.f, 1.f, 1.f));
+        double frameStart = glfwGetTime();
+        unsigned long allocationsBefore = HeapAllocations();
+        glBeginQuery(GL_TIME_ELAPSED, queries[i]);
+        drawFrame(scene, programs, frameUniformBuffer, width, height);
+        glEndQuery(GL_TIME_ELAPSED);
+        allocations += HeapAllocations() - allocationsBefore;
+        cpuTimes.push_back((glfwGetTime() - frameStart) * 1000.0);
     }
     
-    cubicBezier = 0.f;
-    quadraticBezier = 1.f;
-    scaleBy = 1;
-    shiftBy = 0;
-    glPatchParameteri(GL_PATCH_VERTICES, 3);
+    // all the results are in once the GPU has caught up
+    glFinish();
+    vector<double> gpuTimes;
+    for (GLuint query : queries) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        gpuTimes.push_back(elapsed / 1.0e6);
+    }
+    glDeleteQueries(frames, queries.data());
+    
+    size_t uploaded = GeometryBytesUploaded() + distanceBytesUploaded - uploadedBefore;
+    size_t atlasVertices = (fontLoaded == NO_FONT) ? vertices.size()
+                         : glyphAtlas.vertices.size() + distanceAtlas.vertices.size();
+    
+    cout << "  " << setw(28) << left << scenario.name << right
+         << " set-up " << setw(7) << setUp * 1000.0 << " ms"
+         << "  cpu p50/p95/p99 " << percentile(cpuTimes, 0.5) << "/" << percentile(cpuTimes, 0.95)
+         << "/" << percentile(cpuTimes, 0.99) << " ms"
+         << "  gpu p50/p95/p99 " << percentile(gpuTimes, 0.5) << "/" << percentile(gpuTimes, 0.95)
+         << "/" << percentile(gpuTimes, 0.99) << " ms"
+         << "  vertices " << atlasVertices
+         << "  instances " << ((fontLoaded == NO_FONT) ? 0 : textObject.instances.size())
+         << "  uploaded " << uploaded / frames << " B/frame"
+         << "  allocs " << double(allocations) / frames << "/frame" << endl;
+    
+    setTextStyle(&textObject, OUTLINED_TEXT);
 }
 
-void loadAlexBrush()
+// shows a label scene of the given size for the given number of frames, one
+// label changing in each, and prints the frame times along with the draws,
+// labels written, bytes uploaded and heap allocations per frame, which
+// shouldn't grow with the number of labels
+static void runLabelScene(int count, int frames, SceneGeometry *scene, const ScenePrograms *programs,
+                          GLuint frameUniformBuffer, int width, int height)
 {
-    if (!glyphExtractor.LoadFontFile("fonts/alex-brush/AlexBrush-Regular.ttf")) {
-        cout << "Failed to load 'alex-brush.ttf' file" << endl;
+    createLabels(count);
+    showLabels = true;
+    
+    // the first frame builds every label
+    double start = glfwGetTime();
+    drawFrame(scene, programs, frameUniformBuffer, width, height);
+    glFinish();
+    double setUp = glfwGetTime() - start;
+    
+    vector<double> cpuTimes;
+    cpuTimes.reserve(frames);
+    size_t uploadedBefore = GeometryBytesUploaded();
+    size_t draws = 0, written = 0;
+    unsigned long allocations = 0;
+    for (int i = 0; i < frames; i++) {
+        double frameStart = glfwGetTime();
+        unsigned long allocationsBefore = HeapAllocations();
+        drawFrame(scene, programs, frameUniformBuffer, width, height);
+        allocations += HeapAllocations() - allocationsBefore;
+        cpuTimes.push_back((glfwGetTime() - frameStart) * 1000.0);
+        draws += labelScene.drawCalls;
+        written += labelScene.objectsWritten;
     }
-    
-    vertices.clear();
-    colours.clear();
-    bezierType = QUADRATIC;
-    string toPass;
-    
-    if (textIsScrolling) {
-        toPass = "The quick brown fox jumps over the lazy dog.";
-        if (fontShiftBy > resetScroll) {
-            fontShiftBy -= 0.1*textScrollSpeed;
-        } else {
-            fontShiftBy = -0.3;
-        }
-    } else {
-        toPass = "Farzam Noori";
-        fontShiftBy = -2.5f;
-        fontScaleBy = 0.30;
+    glFinish();
+    size_t uploaded = GeometryBytesUploaded() - uploadedBefore;
+    
+    cout << "  " << setw(5) << count << " labels"
+         << "  set-up " << setw(7) << setUp * 1000.0 << " ms"
+         << "  cpu p50/p95/p99 " << percentile(cpuTimes, 0.5) << "/" << percentile(cpuTimes, 0.95)
+         << "/" << percentile(cpuTimes, 0.99) << " ms"
+         << "  draws " << double(draws) / frames << "/frame"
+         << "  written " << double(written) / frames << " labels/frame"
+         << "  uploaded " << uploaded / frames << " B/frame"
+         << "  allocs " << double(allocations) / frames << "/frame"
+         << "  arena " << labelScene.capacity << " vertices" << endl;
+    
+    showLabels = false;
+}
+
+// renders every scenario into an offscreen framebuffer of the window's size
+void runBenchmark(GLFWwindow *window, SceneGeometry *scene, const ScenePrograms *programs,
+                  GLuint frameUniformBuffer, int frames)
+{
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    
+    // frames are timed with a query of their own, which the profiler's
+    // queries can't be nested in
+    showStats = false;
+    SetProfiling(&profiler, false);
+    
+    // colour, plus the stencil that filled text needs
+    GLuint framebuffer, renderbuffers[2];
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        cout << "Benchmark framebuffer is incomplete" << endl;
+    }
+    glViewport(0, 0, width, height);
+    
+    cout << fixed << setprecision(3);
+#if !COUNT_ALLOCATIONS
+    cout << "Heap allocations aren't counted in this build (see COUNT_ALLOCATIONS)" << endl;
+#endif
+    cout << "Font loading:" << endl;
+    const char *fontFiles[] = { LORA_BOLD_ITALIC_FILE, SOURCE_SANS_FILE, QARMIC_SANS_FILE, ALEX_BRUSH_FILE };
+    for (const char *fontFile : fontFiles) {
+        benchmarkFontLoad(fontFile);
+    }
+    benchmarkGlyphService(fontFiles, sizeof(fontFiles) / sizeof(fontFiles[0]));
+    
+    const BenchmarkScenario scenarios[] = {
+        { "quadratic curves",         GLFW_KEY_Q, OUTLINED_TEXT,       false, false },
+        { "cubic curves",             GLFW_KEY_W, OUTLINED_TEXT,       false, false },
+        { "static Source Sans",       GLFW_KEY_A, OUTLINED_TEXT,       false, false },
+        { "static Lora",              GLFW_KEY_S, OUTLINED_TEXT,       false, false },
+        { "static Qarmic Sans",       GLFW_KEY_D, OUTLINED_TEXT,       false, false },
+        { "scrolling Alex Brush",     GLFW_KEY_Z, OUTLINED_TEXT,       false, false },
+        { "scrolling Source Sans",    GLFW_KEY_X, OUTLINED_TEXT,       false, false },
+        { "scrolling Qarmic Sans",    GLFW_KEY_C, OUTLINED_TEXT,       false, false },
+        { "paragraph outlined",       GLFW_KEY_A, OUTLINED_TEXT,       true,  false },
+        { "paragraph filled",         GLFW_KEY_A, FILLED_TEXT,         true,  false },
+        { "paragraph distance field", GLFW_KEY_A, DISTANCE_FIELD_TEXT, true,  false },
+        { "paragraph rebuilt",        GLFW_KEY_A, OUTLINED_TEXT,       true,  true  },
+    };
+    cout << "Scenarios, " << frames << " frames each:" << endl;
+    for (const BenchmarkScenario &scenario : scenarios) {
+        runScenario(window, scenario, frames, scene, programs, frameUniformBuffer, width, height);
     }
     
-    insertString(toPass);
-    
-    for (int i = 0; i < vertices.size(); i++) {
-        colours.push_back(vec3(1.f, 1.f, 1.f));
+    const int labelCounts[] = { 50, 200, 800 };
+    cout << "Label scenes, " << frames << " frames each:" << endl;
+    for (int count : labelCounts) {
+        runLabelScene(count, frames, scene, programs, frameUniformBuffer, width, height);
     }
+    createLabels(0);
     
-    cubicBezier = 0.f;
-    quadraticBezier = 1.f;
-    scaleBy = 1;
-    shiftBy = 0;
-    glPatchParameteri(GL_PATCH_VERTICES, 3);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteRenderbuffers(2, renderbuffers);
+    glDeleteFramebuffers(1, &framebuffer);
+    cout.unsetf(ios::floatfield);
 }
 
 // ==========================================================================
@@ -584,16 +1954,60 @@ int main(int argc, char *argv[])
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8);
+    
+    // --benchmark [frames] runs the benchmark, --profile-dump <file> saves
+    // the times of every frame, --cpu-curves flattens curves on the CPU even
+    // if they could be tessellated, --frame-rate <n> sets the rate of
+    // scrolling text, --labels <n> the size of the label scene
+    bool benchmark = false;
+    int benchmarkFrames = 300;
+    string profileDump;
+    for (int i = 1; i < argc; i++) {
+        string argument = argv[i];
+        if (argument == "--benchmark") {
+            benchmark = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
+                benchmarkFrames = std::max(1, atoi(argv[++i]));
+            }
+        } else if (argument == "--profile-dump" && i + 1 < argc) {
+            profileDump = argv[++i];
+        } else if (argument == "--cpu-curves") {
+            cpuCurves = true;
+        } else if (argument == "--frame-rate" && i + 1 < argc) {
+            targetFrameRate = std::max(0, atoi(argv[++i]));
+        } else if (argument == "--labels" && i + 1 < argc) {
+            labelCount = std::max(1, atoi(argv[++i]));
+        }
+    }
+    
+    // the benchmark draws offscreen, so its window is never shown
+    if (benchmark) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+    
     int width = 512, height = 512;
     window = glfwCreateWindow(width, height, "CPSC 453 OpenGL Boilerplate", 0, 0);
+    
+    // contexts older than 4.0 have no tessellation stages, so fall back to
+    // a 3.3 one, and flatten the curves on the CPU
+    if (!window) {
+        cout << "No OpenGL 4.1 context, trying 3.3" << endl;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(width, height, "CPSC 453 OpenGL Boilerplate", 0, 0);
+    }
     if (!window) {
         cout << "Program failed to create GLFW window, TERMINATING" << endl;
         glfwTerminate();
         return -1;
     }
     
-    // set keyboard callback function and make our context current (active)
+    // set keyboard and window callback functions and make our context
+    // current (active)
     glfwSetKeyCallback(window, KeyCallback);
+    glfwSetWindowRefreshCallback(window, RefreshCallback);
+    glfwSetFramebufferSizeCallback(window, FramebufferSizeCallback);
     glfwMakeContextCurrent(window);
     
     //Intialize GLAD
@@ -606,54 +2020,136 @@ int main(int argc, char *argv[])
     // query and print out information about our OpenGL environment
     QueryGLVersion();
     
-    // call function to load and compile shader programs
-    GLuint program = InitializeShaders();
-    if (program == 0) {
+    cpuCurves = cpuCurves || !GLAD_GL_VERSION_4_0;
+    if (cpuCurves) {
+        cout << "Flattening curves on the CPU (" << FlattenInstructionSet() << ")" << endl;
+    }
+    
+    // call function to load and compile shader programs; the outline and
+    // capture programs tessellate, so they aren't needed without it
+    ScenePrograms programs;
+    if (!initializeVariants(&programs)) {
         cout << "Program could not initialize shaders, TERMINATING" << endl;
         return -1;
     }
     
-    GLuint pointProgram = initializePointShaders();
-    if (pointProgram == 0) {
-        cout << "Point shaders failed to initialize, TERMINATING" << endl;
+    if (!InitializeProgram(&programs.fill, initializeFillShaders())) {
+        cout << "Fill shaders failed to initialize, TERMINATING" << endl;
         return -1;
     }
     
-    // call function to create and fill buffers with geometry data
-    Geometry geometry;
-    if (!InitializeVAO(&geometry)) {
+    if (!InitializeProgram(&programs.distance, initializeDistanceShaders())) {
+        cout << "Distance field shaders failed to initialize, TERMINATING" << endl;
+        return -1;
+    }
+    
+    // static outlines are tessellated every frame without these
+    if (!cpuCurves && (!InitializeProgram(&programs.capture, initializeCaptureShaders()) ||
+        !InitializeProgram(&programs.baked, initializeBakedShaders()) ||
+        !InitializeCapture(&curveBake.capture))) {
+        cout << "Curve capture shaders failed to initialize" << endl;
+        DestroyProgram(&programs.capture);
+        DestroyProgram(&programs.baked);
+    }
+    
+    // and the buffer of the uniforms they share
+    GLuint frameUniformBuffer = 0;
+    if (!InitializeFrameUniforms(&frameUniformBuffer)) {
+        cout << "Program failed to initialize frame uniforms!" << endl;
+    }
+    
+    // call function to create the buffers of all the scene's geometry
+    SceneGeometry scene;
+    if (!InitializeVAO(&scene.curves) || !InitializeVAO(&scene.text, SNORM16_POSITIONS) ||
+        !InitializeVAO(&scene.distance, SNORM16_POSITIONS) || !InitializeVAO(&scene.stats, SNORM16_POSITIONS)) {
         cout << "Program failed to intialize geometry!" << endl;
     }
+    if (!InitializeSceneArena(&labelScene, 1 << 16)) {
+        cout << "Program failed to initialize the label scene!" << endl;
+    }
     
-    drawPoints = 1.f;
+    // and the queries timing each frame
+    if (!InitializeProfiler(&profiler)) {
+        cout << "Program failed to initialize the profiler!" << endl;
+    }
+    if (!profileDump.empty() && !benchmark) {
+        OpenProfileDump(&profiler, profileDump);
+    }
+    
+    // every patch has four control points, and is tagged with its degree
+    if (!cpuCurves) {
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+    }
+    
+    // decode the demo fonts while nothing is shown yet, so switching to
+    // them later is immediate; each one finished wakes the main loop
+    fontLoader.SetReadyCallback(glfwPostEmptyEvent);
+    requestFont(LORA_BOLD_ITALIC_FILE);
+    requestFont(SOURCE_SANS_FILE);
+    requestFont(QARMIC_SANS_FILE);
+    requestFont(ALEX_BRUSH_FILE);
+    
+    if (benchmark) {
+        runBenchmark(window, &scene, &programs, frameUniformBuffer, benchmarkFrames);
+    }
     
-    // run an event-triggered main loop
-    while (!glfwWindowShouldClose(window))
+    // run an event-triggered main loop: a frame is drawn when something
+    // shown has changed, or scrolling text is due to move
+    int swapInterval = chooseSwapInterval(targetFrameRate);
+    double framePeriod = (targetFrameRate > 0) ? 1.0 / targetFrameRate : 0.0;
+    double nextFrame = 0.0;
+    
+    // when the swap interval paces the frames, one is due up to half a
+    // period early, so jitter in when the swap returns never costs a
+    // refresh; the deadline still holds when the swap doesn't wait, as for
+    // hidden or occluded windows, or drivers that ignore the interval
+    double slack = (swapInterval > 0) ? 0.5 * framePeriod : 0.0;
+    while (!benchmark && !glfwWindowShouldClose(window))
     {
-        if(!LoadGeometry(&geometry, vertices.size())) {
-            cout << "Failed to load geometry" << endl;
+        double now = glfwGetTime();
+        bool animating = isAnimating();
+        bool frameDue = now >= nextFrame - slack;
+        if (isFrameNeeded() || (animating && frameDue)) {
+            redrawNeeded = false;
+    
+            int framebufferWidth, framebufferHeight;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            drawFrame(&scene, &programs, frameUniformBuffer, framebufferWidth, framebufferHeight);
+    
+            glfwSwapBuffers(window);
+            nextFrame = std::max(nextFrame + framePeriod, now);
         }
-        
-        if (textIsScrolling && fontLoaded == ALEX_BRUSH) {
-            loadAlexBrush();
-        } else if (textScrollSpeed && fontLoaded == INCONSOLATA) {
-            loadInconsolata();
-        } else if (textScrollSpeed && fontLoaded == QARMIC_SANS) {
-            loadQarmicSans();
+    
+        // while animating, sleep until the next frame is due, which is at
+        // once if the swap already waited for the display; otherwise sleep
+        // until an event, or the overlay's numbers are due
+        if (animating) {
+            glfwWaitEventsTimeout(std::max(0.0, nextFrame - slack - glfwGetTime()));
+        } else {
+            glfwWaitEventsTimeout(showStats ? STATS_REFRESH_INTERVAL : IDLE_WAIT);
         }
-        
-        // call function to draw our scene
-        RenderScene(&geometry, program, pointProgram);
-        
-        glfwSwapBuffers(window);
-        
-        glfwPollEvents();
     }
-    
+    fontLoader.SetReadyCallback(nullptr);
+
     // clean up allocated resources before exit
-    DestroyGeometry(&geometry);
+    DestroyGeometry(&scene.curves);
+    DestroyGeometry(&scene.text);
+    DestroyGeometry(&scene.distance);
+    DestroyGeometry(&scene.stats);
+    DestroySceneArena(&labelScene);
+    DestroyProfiler(&profiler);
+    DestroyTexture(&distanceTexture);
+    glDeleteBuffers(1, &frameUniformBuffer);
     glUseProgram(0);
-    glDeleteProgram(program);
+    for (map<ProgramVariant, ShaderProgram>::iterator i = programs.variants.begin();
+         i != programs.variants.end(); i++) {
+        DestroyProgram(&i->second);
+    }
+    DestroyProgram(&programs.fill);
+    DestroyProgram(&programs.distance);
+    DestroyProgram(&programs.capture);
+    DestroyProgram(&programs.baked);
+    DestroyCapture(&curveBake.capture);
     glfwDestroyWindow(window);
     glfwTerminate();
     
@@ -704,11 +2200,21 @@ bool CheckGLErrors()
     return error;
 }
 
+// the check after a frame's draws, which is only made if GL_ERROR_CHECKS
+// asks for it, so frames don't wait on the driver
+void CheckDrawErrors()
+{
+#if GL_ERROR_CHECKS
+    CheckGLErrors();
+#endif
+}
+
 // --------------------------------------------------------------------------
 // OpenGL shader support functions
 
-// reads a text file with the given name into a string
-string LoadSource(const string &filename)
+// reads a text file with the given name into a string, with the given
+// #defines inserted after its #version line to compile a variant of it
+string LoadSource(const string &filename, const string &defines)
 {
     string source;
     
@@ -724,6 +2230,19 @@ string LoadSource(const string &filename)
         << filename << endl;
     }
     
+    // the shaders that don't tessellate only need GLSL 3.30, so they are
+    // retargeted to it for contexts without tessellation
+    const string version = "#version 410";
+    size_t found = source.find(version);
+    if (cpuCurves && found != string::npos) {
+        source.replace(found, version.size(), "#version 330 core");
+    }
+    
+    size_t versionEnd = source.find('\n', source.find("#version"));
+    if (!defines.empty() && versionEnd != string::npos) {
+        source.insert(versionEnd + 1, defines);
+    }
+    
     return source;
 }
 
@@ -755,8 +2274,11 @@ GLuint CompileShader(GLenum shaderType, const string &source)
     return shaderObject;
 }
 
-// creates and returns a program object linked from vertex and fragment shaders
-GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint tcsShader, GLuint tesShader)
+// creates and returns a program object linked from vertex and fragment shaders,
+// capturing the given outputs of its last stage if it is used for transform
+// feedback
+GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint tcsShader, GLuint tesShader,
+                   const char *const *feedbackVaryings, GLsizei feedbackVaryingCount)
 {
     // allocate program object name
     GLuint programObject = glCreateProgram();
@@ -767,6 +2289,16 @@ GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint tcsShader,
     if (tcsShader) glAttachShader(programObject, tcsShader);
     if (tesShader) glAttachShader(programObject, tesShader);
     
+    // ask for a binary that can be saved for the next run
+    if (GLAD_GL_ARB_get_program_binary && glProgramParameteri) {
+        glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    
+    if (feedbackVaryingCount > 0) {
+        glTransformFeedbackVaryings(programObject, feedbackVaryingCount, feedbackVaryings,
+                                    GL_INTERLEAVED_ATTRIBS);
+    }
+    
     // try linking the program with given attachments
     glLinkProgram(programObject);
     
@@ -786,51 +2318,305 @@ GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, GLuint tcsShader,
     return programObject;
 }
 
-float insertGlyphCharacter(char charToInsert, float advance, float shiftToCentre, float scaleToFit)
-{
-    myGlyph = glyphExtractor.ExtractGlyph(charToInsert);
-    
-    for (int i = 0; i < myGlyph.contours.size(); i++) {
-        
-        MyContour myContour = myGlyph.contours[i];
-        for (int j = 0; j < myContour.size(); j++) {
-
-            MySegment mySegment = myContour[j];
-            for (int k = 0; k <= mySegment.degree; k++) {
-                
-                if (mySegment.degree == 1 && bezierType == CUBIC) {
-                    
-                    vertices.push_back(vec2( (mySegment.x[k] + advance + shiftToCentre) * scaleToFit, (mySegment.y[k] + fontYShiftBy) * scaleToFit ));
-                    vertices.push_back(vec2( (mySegment.x[k] + advance + shiftToCentre) * scaleToFit, (mySegment.y[k] + fontYShiftBy) * scaleToFit ));
-                    
-                } else if (mySegment.degree == 1 && bezierType == QUADRATIC) {
-                    
-                    if (k == 0) {
-                        vertices.push_back(vec2( (mySegment.x[k] + advance + shiftToCentre) * scaleToFit, (mySegment.y[k] + fontYShiftBy) * scaleToFit  ));
-                    }
-                    vertices.push_back(vec2( (mySegment.x[k] + advance + shiftToCentre) * scaleToFit, (mySegment.y[k] + fontYShiftBy) * scaleToFit  ));
-                    
-                } else {
-                    
-                    vertices.push_back(vec2( (mySegment.x[k] + advance + shiftToCentre) * scaleToFit, (mySegment.y[k] + fontYShiftBy) * scaleToFit  ));
-                    
-                }
-            }
+// adds a vertex with its tag to the atlas
+static void addAtlasVertex(GlyphAtlas *atlas, vec2 point, GLubyte tag)
+{
+    atlas->vertices.push_back(point);
+    atlas->tags.push_back(tag);
+}
+
+// adds the triangles that fill a glyph through the stencil buffer: a fan
+// from the origin over the chord of every segment, plus a triangle around
+// each curve, of which only the part between the chord and the curve is
+// drawn. Cubics are split in half and each half approximated by a
+// quadratic. The glyph's bounding box is added last, to cover the fill.
+static void addGlyphFill(GlyphAtlas *atlas, const MyGlyph &myGlyph, GlyphAtlasEntry *entry)
+{
+    entry->fillFirst = atlas->vertices.size();
+    entry->fillCount = 0;
+    entry->coverFirst = atlas->vertices.size();
+    if (myGlyph.segmentCount == 0) return;
+    
+    vec2 lower(myGlyph.points[0].x, myGlyph.points[0].y);
+    vec2 upper = lower;
+    
+    for (int i = 0; i < myGlyph.segmentCount; i++) {
+        
+        const MySegmentEntry &mySegment = myGlyph.segments[i];
+        vec2 p[4];
+        for (unsigned int k = 0; k <= mySegment.degree; k++) {
+            const MyPoint &controlPoint = myGlyph.points[mySegment.offset + k];
+            p[k] = vec2(controlPoint.x, controlPoint.y);
+            lower = min(lower, p[k]);
+            upper = max(upper, p[k]);
+        }
+        
+        // quadratic pieces of the segment, as start, control point and end
+        vec2 pieces[2][3];
+        int pieceCount = 0;
+        if (mySegment.degree == 2) {
+            pieces[0][0] = p[0]; pieces[0][1] = p[1]; pieces[0][2] = p[2];
+            pieceCount = 1;
+        } else if (mySegment.degree == 3) {
+            vec2 p01 = 0.5f * (p[0] + p[1]), p12 = 0.5f * (p[1] + p[2]), p23 = 0.5f * (p[2] + p[3]);
+            vec2 p012 = 0.5f * (p01 + p12), p123 = 0.5f * (p12 + p23);
+            vec2 middle = 0.5f * (p012 + p123);
+            pieces[0][0] = p[0];   pieces[0][1] = 0.25f * (3.f * (p01 + p012) - p[0] - middle);   pieces[0][2] = middle;
+            pieces[1][0] = middle; pieces[1][1] = 0.25f * (3.f * (p123 + p23) - middle - p[3]);   pieces[1][2] = p[3];
+            pieceCount = 2;
+        }
+        
+        if (pieceCount == 0) {
+            addAtlasVertex(atlas, vec2(0.f), FILL_INTERIOR);
+            addAtlasVertex(atlas, p[0], FILL_INTERIOR);
+            addAtlasVertex(atlas, p[1], FILL_INTERIOR);
+        }
+        for (int k = 0; k < pieceCount; k++) {
+            addAtlasVertex(atlas, vec2(0.f), FILL_INTERIOR);
+            addAtlasVertex(atlas, pieces[k][0], FILL_INTERIOR);
+            addAtlasVertex(atlas, pieces[k][2], FILL_INTERIOR);
+            
+            addAtlasVertex(atlas, pieces[k][0], FILL_CURVE_START);
+            addAtlasVertex(atlas, pieces[k][1], FILL_CURVE_CONTROL);
+            addAtlasVertex(atlas, pieces[k][2], FILL_CURVE_END);
+        }
+    }
+    entry->fillCount = atlas->vertices.size() - entry->fillFirst;
+    
+    // the fan reaches the origin, so the cover must too
+    lower = min(lower, vec2(0.f));
+    upper = max(upper, vec2(0.f));
+    
+    entry->coverFirst = atlas->vertices.size();
+    addAtlasVertex(atlas, vec2(lower.x, lower.y), FILL_INTERIOR);
+    addAtlasVertex(atlas, vec2(upper.x, lower.y), FILL_INTERIOR);
+    addAtlasVertex(atlas, vec2(lower.x, upper.y), FILL_INTERIOR);
+    addAtlasVertex(atlas, vec2(upper.x, upper.y), FILL_INTERIOR);
+}
+
+// vertices a glyph takes in the outline atlas: four for each curve's patch,
+// two for each line, the fill's triangles (one for a line, two for a
+// quadratic, four for a cubic, split in two) and the cover strip; glyphs
+// flattened on the CPU take more
+static size_t atlasVertexCount(const MyGlyph &myGlyph)
+{
+    if (myGlyph.segmentCount == 0) return 0;
+    
+    size_t count = 4;
+    for (int i = 0; i < myGlyph.segmentCount; i++) {
+        unsigned int degree = myGlyph.segments[i].degree;
+        count += (degree == 1) ? 2 + 3 : (degree == 2) ? 4 + 6 : 4 + 12;
+    }
+    return count;
+}
+
+// reserves room in the atlases for every glyph of a font that came in, so
+// showing its characters only copies them in
+void reserveAtlases(const LoadedFont &font)
+{
+    size_t vertexCount = 0;
+    for (const pair<const int, MyGlyph> &glyph : font.glyphs) {
+        vertexCount += atlasVertexCount(glyph.second);
+    }
+    glyphAtlas.reservedVertices += vertexCount;
+    glyphAtlas.vertices.reserve(glyphAtlas.reservedVertices);
+    glyphAtlas.tags.reserve(glyphAtlas.reservedVertices);
+    
+    // four corners of each quad
+    distanceAtlas.reservedVertices += 4 * font.glyphs.size();
+    distanceAtlas.vertices.reserve(distanceAtlas.reservedVertices);
+    distanceAtlas.textureCoords.reserve(distanceAtlas.reservedVertices);
+}
+
+// returns the atlas entry of a character of the font, adding the control
+// points of its glyph to the atlas if it isn't there yet
+const GlyphAtlasEntry &findAtlasGlyph(GlyphAtlas *atlas, const string &fontFile, int character,
+                                      const MyGlyph &myGlyph)
+{
+    GlyphAtlasKey key(fontFile, character);
+    map<GlyphAtlasKey, GlyphAtlasEntry>::iterator found = atlas->entries.find(key);
+    if (found != atlas->entries.end()) {
+        return found->second;
+    }
+    
+    vector<vec2> &points = atlas->vertices;
+    
+    GlyphAtlasEntry entry;
+    entry.first = points.size();
+    entry.bounds = myGlyph.bounds;
+    
+    // curves go into the glyph's patches, lines are left for the second
+    // pass; quadratics are padded out to four points with their end point.
+    // Without tessellation, the curves are flattened into the lines instead
+    for (int i = 0; i < myGlyph.segmentCount && !cpuCurves; i++) {
+        
+        const MySegmentEntry &mySegment = myGlyph.segments[i];
+        const MyPoint *controlPoints = &myGlyph.points[mySegment.offset];
+        if (mySegment.degree == 1) continue;
+        
+        for (int k = 0; k < 4; k++) {
+            const MyPoint &controlPoint = controlPoints[std::min<unsigned int>(k, mySegment.degree)];
+            points.push_back(vec2( controlPoint.x, controlPoint.y ));
+            atlas->tags.push_back(mySegment.degree);
+        }
+    }
+    entry.count = points.size() - entry.first;
+    
+    entry.lineFirst = points.size();
+    for (int i = 0; i < myGlyph.segmentCount; i++) {
+        
+        const MySegmentEntry &mySegment = myGlyph.segments[i];
+        const MyPoint *controlPoints = &myGlyph.points[mySegment.offset];
+        if (mySegment.degree != 1) continue;
+        
+        points.push_back(vec2( controlPoints[0].x, controlPoints[0].y ));
+        points.push_back(vec2( controlPoints[1].x, controlPoints[1].y ));
+    }
+    if (cpuCurves) {
+        FlattenGlyph(myGlyph, CPU_GLYPH_TOLERANCE, &points);
+    }
+    entry.lineCount = points.size() - entry.lineFirst;
+    atlas->tags.resize(points.size(), 1);   // lines aren't patches
+    
+    addGlyphFill(atlas, myGlyph, &entry);
+    
+    atlas->dirty = atlas->dirty || entry.count > 0 || entry.lineCount > 0;
+    
+    return atlas->entries.insert(make_pair(key, entry)).first->second;
+}
+
+// orders placed characters by glyph, so each glyph is drawn in one batch
+static bool compareAtlasGlyphs(const pair<const GlyphAtlasEntry *, GeometryInstance> &a,
+                               const pair<const GlyphAtlasEntry *, GeometryInstance> &b)
+{
+    return a.first->first < b.first->first;
+}
+
+// returns the distance atlas entry of a character of the font, rasterizing
+// its glyph into the distance field if it isn't there yet
+const DistanceAtlasEntry &findDistanceGlyph(DistanceAtlas *atlas, const string &fontFile, int character,
+                                            const MyGlyph &myGlyph)
+{
+    GlyphAtlasKey key(fontFile, character);
+    map<GlyphAtlasKey, DistanceAtlasEntry>::iterator found = atlas->entries.find(key);
+    if (found != atlas->entries.end()) {
+        return found->second;
+    }
+    
+    DistanceFieldGlyph placed;
+    DistanceAtlasEntry entry;
+    entry.first = atlas->vertices.size();
+    entry.empty = true;
+    
+    if (!atlas->field.AddGlyph(myGlyph, &placed)) {
+        cout << "Distance field atlas is full, skipping character " << character << endl;
+    } else if (!placed.empty) {
+        // the quad's corners, in triangle strip order
+        entry.bounds.xMin = placed.left;
+        entry.bounds.yMin = placed.bottom;
+        entry.bounds.xMax = placed.right;
+        entry.bounds.yMax = placed.top;
+        atlas->vertices.push_back(vec2(placed.left, placed.bottom));
+        atlas->vertices.push_back(vec2(placed.right, placed.bottom));
+        atlas->vertices.push_back(vec2(placed.left, placed.top));
+        atlas->vertices.push_back(vec2(placed.right, placed.top));
+        atlas->textureCoords.push_back(vec2(placed.u0, placed.v0));
+        atlas->textureCoords.push_back(vec2(placed.u1, placed.v0));
+        atlas->textureCoords.push_back(vec2(placed.u0, placed.v1));
+        atlas->textureCoords.push_back(vec2(placed.u1, placed.v1));
+        entry.empty = false;
+        atlas->dirty = true;
+    }
+    
+    return atlas->entries.insert(make_pair(key, entry)).first->second;
+}
+
+// orders placed characters by glyph, so each glyph is drawn in one batch
+static bool compareDistanceGlyphs(const pair<const DistanceAtlasEntry *, GeometryInstance> &a,
+                                  const pair<const DistanceAtlasEntry *, GeometryInstance> &b)
+{
+    return a.first->first < b.first->first;
+}
+
+// lays the text out as instances of the quads in the distance atlas, one
+// batch of each glyph
+static void insertDistanceString(TextObject *textObject)
+{
+    const GlyphRun &run = *textObject->run;
+    vector<pair<const DistanceAtlasEntry *, GeometryInstance> > placed;
+    placed.reserve(run.glyphs.size());
+    
+    for (size_t i = 0; i < run.glyphs.size(); i++) {
+        const DistanceAtlasEntry &glyph = findDistanceGlyph(&distanceAtlas, textObject->fontFile,
+                                                            run.characters[i], run.glyphs[i]);
+        if (!glyph.empty) {
+            GeometryInstance instance = { vec2(run.pens[i], textObject->yShiftBy), textObject->scaleBy, textObject->colour };
+            placed.push_back(make_pair(&glyph, instance));
         }
     }
     
-    return myGlyph.advance;
+    stable_sort(placed.begin(), placed.end(), compareDistanceGlyphs);
+    
+    for (size_t i = 0, end; i < placed.size(); i = end) {
+        const DistanceAtlasEntry *glyph = placed[i].first;
+        for (end = i; end < placed.size() && placed[end].first == glyph; end++) {
+            textObject->instances.push_back(placed[end].second);
+        }
+        
+        GeometryBatch batch = { GL_TRIANGLE_STRIP, glyph->first, 4, GLint(i), GLsizei(end - i) };
+        textObject->batches.push_back(batch);
+        textObject->batchBounds.push_back(glyph->bounds);
+    }
 }
 
-void insertString(string text)
+void insertString(TextObject *textObject, GlyphAtlas *atlas)
 {
-    int textLenght = text.length();
-    char textCharArr[textLenght + 1];
-    strcpy(textCharArr, text.c_str());
+    if (textObject->style == DISTANCE_FIELD_TEXT) {
+        insertDistanceString(textObject);
+        return;
+    }
     
-    float advanceBy = insertGlyphCharacter(textCharArr[0], 0, fontShiftBy, fontScaleBy);
-    for (int i = 1; i < textLenght; i++) {
-        advanceBy += insertGlyphCharacter(textCharArr[i], advanceBy, fontShiftBy, fontScaleBy);
+    // place each character at its pen position, remembering its glyph
+    const GlyphRun &run = *textObject->run;
+    vector<pair<const GlyphAtlasEntry *, GeometryInstance> > placed;
+    placed.reserve(run.glyphs.size());
+    
+    for (size_t i = 0; i < run.glyphs.size(); i++) {
+        const GlyphAtlasEntry &glyph = findAtlasGlyph(atlas, textObject->fontFile,
+                                                      run.characters[i], run.glyphs[i]);
+        if (glyph.count > 0 || glyph.lineCount > 0) {
+            GeometryInstance instance = { vec2(run.pens[i], textObject->yShiftBy), textObject->scaleBy, textObject->colour };
+            placed.push_back(make_pair(&glyph, instance));
+        }
+    }
+    
+    stable_sort(placed.begin(), placed.end(), compareAtlasGlyphs);
+    
+    // each glyph is outlined as a batch of patches and a batch of lines,
+    // over the same run of instances
+    for (size_t i = 0, end; i < placed.size(); i = end) {
+        const GlyphAtlasEntry *glyph = placed[i].first;
+        for (end = i; end < placed.size() && placed[end].first == glyph; end++) {
+            textObject->instances.push_back(placed[end].second);
+        }
+        
+        if (glyph->count > 0) {
+            GeometryBatch batch = { GL_PATCHES, glyph->first, glyph->count, GLint(i), GLsizei(end - i) };
+            textObject->batches.push_back(batch);
+        }
+        if (glyph->lineCount > 0) {
+            GeometryBatch batch = { GL_LINES, glyph->lineFirst, glyph->lineCount, GLint(i), GLsizei(end - i) };
+            textObject->batches.push_back(batch);
+        }
+        
+        // and filled, as a batch of triangles and a strip to cover them
+        if (glyph->fillCount > 0) {
+            GeometryBatch fill = { GL_TRIANGLES, glyph->fillFirst, glyph->fillCount, GLint(i), GLsizei(end - i) };
+            GeometryBatch cover = { GL_TRIANGLE_STRIP, glyph->coverFirst, 4, GLint(i), GLsizei(end - i) };
+            textObject->batches.push_back(fill);
+            textObject->batches.push_back(cover);
+        }
+        textObject->batchBounds.resize(textObject->batches.size(), glyph->bounds);
     }
 }
 
@@ -885,6 +2671,68 @@ void addVertices(BezierCurve type)
     }
 }
 
+// fills every patch of the demo curves out to four control points, tagging
+// them with their degree; the points are spread out in place, from the last
+// patch back, so no point is overwritten before it has moved
+void padPatches(BezierCurve type)
+{
+    unsigned int degree = (type == CUBIC) ? 3 : 2;
+    size_t patches = vertices.size() / (degree + 1);
+    vertices.resize(4 * patches);
+    colours.resize(4 * patches);
+    
+    for (size_t i = patches; i-- > 0; ) {
+        for (unsigned int k = 4; k-- > 0; ) {
+            size_t index = i * (degree + 1) + std::min(k, degree);
+            vertices[4 * i + k] = vertices[index];
+            colours[4 * i + k] = colours[index];
+        }
+    }
+    
+    degrees.assign(vertices.size(), GLubyte(degree));
+}
+
+// adds the edges between consecutive control points of every patch, as
+// lines after the patches, and the batches that draw them all; without
+// tessellation the patches are flattened into more lines after those
+void addControlPolygon(BezierCurve type)
+{
+    unsigned int degree = (type == CUBIC) ? 3 : 2;
+    GLsizei patchElements = vertices.size();
+    
+    flattenedLines.clear();
+    flattenedColours.clear();
+    if (cpuCurves) {
+        FlattenPatches(vertices, colours, degrees, 0, patchElements, CPU_CURVE_TOLERANCE,
+                       &flattenedLines, &flattenedColours);
+    }
+    
+    // two points for each edge of each patch, then the flattened lines
+    size_t total = patchElements + (patchElements / 4) * degree * 2 + flattenedLines.size();
+    vertices.reserve(total);
+    colours.reserve(total);
+    
+    for (GLsizei i = 0; i + 3 < patchElements; i += 4) {
+        for (unsigned int k = 0; k < degree; k++) {
+            vertices.push_back(vertices[i + k]);
+            vertices.push_back(vertices[i + k + 1]);
+            colours.push_back(colours[i + k]);
+            colours.push_back(colours[i + k + 1]);
+        }
+    }
+    vertices.insert(vertices.end(), flattenedLines.begin(), flattenedLines.end());
+    colours.insert(colours.end(), flattenedColours.begin(), flattenedColours.end());
+    degrees.resize(vertices.size(), 1);     // lines aren't patches
+    
+    GLsizei lineElements = GLsizei(vertices.size()) - patchElements;
+    curveBatches.clear();
+    if (!cpuCurves) {
+        curveBatches.push_back({ GL_PATCHES, 0, patchElements, 0, 0 });
+    }
+    curveBatches.push_back({ GL_POINTS, 0, patchElements, 0, 0 });
+    curveBatches.push_back({ GL_LINES, patchElements, lineElements, 0, 0 });
+}
+
 void addColours()
 {
     colours.push_back(vec3( 1.0f, 0.0f, 0.0f ));
@@ -0,0 +1,283 @@
+#include "profiler.h"
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+bool CheckGLErrors();
+
+// --------------------------------------------------------------------------
+// Heap allocation counting
+
+#if COUNT_ALLOCATIONS
+
+// allocations made by each thread so far
+static thread_local unsigned long heapAllocations = 0;
+
+// the standard array and nothrow forms all allocate through this one
+void *operator new(size_t size)
+{
+    ++heapAllocations;
+    for (;;) {
+        if (void *memory = malloc(size ? size : 1)) return memory;
+
+        new_handler handler = get_new_handler();
+        if (!handler) throw bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+unsigned long HeapAllocations()
+{
+    return heapAllocations;
+}
+
+#else
+
+unsigned long HeapAllocations()
+{
+    return 0;
+}
+
+#endif
+
+// --------------------------------------------------------------------------
+
+// weight of each new frame in the running average
+static const double AVERAGE_WEIGHT = 0.1;
+
+FrameProfile::FrameProfile()
+    : frameCpu(0.0), allocations(0.0)
+{
+    for (int i = 0; i < PROFILE_SECTIONS; i++) {
+        cpu[i] = 0.0;
+        gpu[i] = -1.0;
+    }
+}
+
+Profiler::Profiler()
+    : enabled(false), inFrame(false), frame(0), resolved(0),
+      traceEvents(false), firstEvent(true), epoch(chrono::steady_clock::now())
+{
+    for (int i = 0; i < PROFILE_LATENCY; i++) {
+        for (int k = 0; k < PROFILE_SECTIONS; k++) {
+            queries[i][k] = 0;
+            issued[i][k] = false;
+            cpuStart[i][k] = cpuEnd[i][k] = 0.0;
+        }
+        frameStart[i] = frameEnd[i] = 0.0;
+        allocationsStart[i] = allocationsEnd[i] = 0;
+        pending[i] = false;
+    }
+}
+
+// seconds since the profiler was created, from the highest resolution
+// clock that never goes backwards
+static double ProfileClock(const Profiler *profiler)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - profiler->epoch).count();
+}
+
+bool InitializeProfiler(Profiler *profiler)
+{
+    glGenQueries(PROFILE_LATENCY * PROFILE_SECTIONS, &profiler->queries[0][0]);
+    return !CheckGLErrors();
+}
+
+void SetProfiling(Profiler *profiler, bool enabled)
+{
+    profiler->enabled = enabled;
+    profiler->inFrame = false;
+    for (int i = 0; i < PROFILE_LATENCY; i++) {
+        profiler->pending[i] = false;
+        for (int k = 0; k < PROFILE_SECTIONS; k++)
+            profiler->issued[i][k] = false;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Dumps of collected frames
+
+// one complete event in Chrome's trace event format, in microseconds
+static void WriteTraceEvent(Profiler *profiler, const char *name, int thread, double start, double duration)
+{
+    if (!profiler->firstEvent) profiler->dump << "," << endl;
+    profiler->firstEvent = false;
+    profiler->dump << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+                   << ",\"ts\":" << start * 1.0e6 << ",\"dur\":" << duration * 1.0e6 << "}";
+}
+
+static void DumpFrame(Profiler *profiler, int slot, unsigned long frame, const FrameProfile &times)
+{
+    if (!profiler->dump.is_open()) return;
+
+    if (!profiler->traceEvents) {
+        profiler->dump << frame << "," << times.frameCpu;
+        for (int i = 0; i < PROFILE_SECTIONS; i++)
+            profiler->dump << "," << times.cpu[i] << "," << times.gpu[i];
+        profiler->dump << "," << times.allocations << endl;
+        return;
+    }
+
+    // the CPU phases on one track, and the GPU's on another; timer queries
+    // only measure durations, so GPU phases are shown starting when the CPU
+    // issued them
+    WriteTraceEvent(profiler, "frame", 1, profiler->frameStart[slot],
+                    profiler->frameEnd[slot] - profiler->frameStart[slot]);
+    for (int i = 0; i < PROFILE_SECTIONS; i++) {
+        if (!profiler->issued[slot][i]) continue;
+
+        const char *name = ProfileSectionName(ProfileSection(i));
+        WriteTraceEvent(profiler, name, 1, profiler->cpuStart[slot][i], times.cpu[i] / 1000.0);
+        if (times.gpu[i] >= 0.0)
+            WriteTraceEvent(profiler, name, 2, profiler->cpuStart[slot][i], times.gpu[i] / 1000.0);
+    }
+}
+
+bool OpenProfileDump(Profiler *profiler, const string &path)
+{
+    profiler->traceEvents = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    profiler->dump.open(path.c_str(), ios::trunc);
+    if (!profiler->dump) {
+        cout << "Failed to create profile dump " << path << endl;
+        return false;
+    }
+
+    if (profiler->traceEvents) {
+        profiler->dump << "[" << endl;
+    } else {
+        profiler->dump << "frame,frame_cpu_ms";
+        for (int i = 0; i < PROFILE_SECTIONS; i++) {
+            const char *name = ProfileSectionName(ProfileSection(i));
+            profiler->dump << "," << name << "_cpu_ms," << name << "_gpu_ms";
+        }
+        profiler->dump << ",allocations" << endl;
+    }
+
+    SetProfiling(profiler, true);
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Frames and their phases
+
+// reads back the times of the frame in a slot of the ring; queries that
+// still aren't done are left unknown rather than waited for
+static void CollectFrame(Profiler *profiler, int slot, unsigned long frame)
+{
+    if (!profiler->pending[slot]) return;
+
+    FrameProfile times;
+    times.frameCpu = (profiler->frameEnd[slot] - profiler->frameStart[slot]) * 1000.0;
+    times.allocations = double(profiler->allocationsEnd[slot] - profiler->allocationsStart[slot]);
+    for (int i = 0; i < PROFILE_SECTIONS; i++) {
+        if (!profiler->issued[slot][i]) continue;
+        times.cpu[i] = (profiler->cpuEnd[slot][i] - profiler->cpuStart[slot][i]) * 1000.0;
+
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(profiler->queries[slot][i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(profiler->queries[slot][i], GL_QUERY_RESULT, &elapsed);
+            times.gpu[i] = elapsed / 1.0e6;
+        }
+    }
+
+    // phases that didn't run count as taking no time in the average
+    FrameProfile &average = profiler->average;
+    double weight = profiler->resolved ? AVERAGE_WEIGHT : 1.0;
+    average.frameCpu += (times.frameCpu - average.frameCpu) * weight;
+    average.allocations += (times.allocations - average.allocations) * weight;
+    for (int i = 0; i < PROFILE_SECTIONS; i++) {
+        average.cpu[i] += (times.cpu[i] - average.cpu[i]) * weight;
+        double gpu = profiler->issued[slot][i] ? times.gpu[i] : 0.0;
+        if (gpu < 0.0) continue;
+        average.gpu[i] = (average.gpu[i] < 0.0) ? gpu : average.gpu[i] + (gpu - average.gpu[i]) * weight;
+    }
+    profiler->latest = times;
+    profiler->resolved++;
+
+    DumpFrame(profiler, slot, frame, times);
+
+    profiler->pending[slot] = false;
+    for (int i = 0; i < PROFILE_SECTIONS; i++)
+        profiler->issued[slot][i] = false;
+}
+
+void BeginProfileFrame(Profiler *profiler)
+{
+    profiler->inFrame = profiler->enabled;
+    if (!profiler->enabled) return;
+
+    int slot = profiler->frame % PROFILE_LATENCY;
+    CollectFrame(profiler, slot, profiler->frame - PROFILE_LATENCY);
+    profiler->frameStart[slot] = ProfileClock(profiler);
+    profiler->allocationsStart[slot] = HeapAllocations();
+}
+
+void EndProfileFrame(Profiler *profiler)
+{
+    if (!profiler->inFrame) return;
+
+    int slot = profiler->frame % PROFILE_LATENCY;
+    profiler->frameEnd[slot] = ProfileClock(profiler);
+    profiler->allocationsEnd[slot] = HeapAllocations();
+    profiler->pending[slot] = true;
+    profiler->inFrame = false;
+    profiler->frame++;
+}
+
+void BeginProfileSection(Profiler *profiler, ProfileSection section)
+{
+    if (!profiler->inFrame) return;
+
+    int slot = profiler->frame % PROFILE_LATENCY;
+    profiler->issued[slot][section] = true;
+    profiler->cpuStart[slot][section] = ProfileClock(profiler);
+    glBeginQuery(GL_TIME_ELAPSED, profiler->queries[slot][section]);
+}
+
+void EndProfileSection(Profiler *profiler, ProfileSection section)
+{
+    if (!profiler->inFrame) return;
+
+    int slot = profiler->frame % PROFILE_LATENCY;
+    glEndQuery(GL_TIME_ELAPSED);
+    profiler->cpuEnd[slot][section] = ProfileClock(profiler);
+}
+
+const char *ProfileSectionName(ProfileSection section)
+{
+    switch (section) {
+        case PROFILE_LAYOUT:    return "layout";
+        case PROFILE_UPLOAD:    return "upload";
+        case PROFILE_PATCHES:   return "patches";
+        case PROFILE_LINES:     return "lines";
+        default:                return "unknown";
+    }
+}
+
+void DestroyProfiler(Profiler *profiler)
+{
+    glDeleteQueries(PROFILE_LATENCY * PROFILE_SECTIONS, &profiler->queries[0][0]);
+    for (int i = 0; i < PROFILE_LATENCY; i++) {
+        for (int k = 0; k < PROFILE_SECTIONS; k++)
+            profiler->queries[i][k] = 0;
+    }
+
+    if (profiler->dump.is_open()) {
+        if (profiler->traceEvents) profiler->dump << endl << "]" << endl;
+        profiler->dump.close();
+    }
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <glad/glad.h>
+
+// --------------------------------------------------------------------------
+// Compile-time switches of the instrumentation
+
+// CheckGLErrors() drains the error queue with glGetError, which makes the
+// driver catch up with every command issued so far. Initialization and
+// uploads always check, since they report failure by it, but the checks
+// after each frame's draws are only compiled in when asked for; errors of
+// draws are otherwise reported by the next check. Debug builds ask for them
+// by default, building with GL_ERROR_CHECKS=0 or 1 overrides.
+#ifndef GL_ERROR_CHECKS
+#ifdef DEBUG
+#define GL_ERROR_CHECKS 1
+#else
+#define GL_ERROR_CHECKS 0
+#endif
+#endif
+
+// Every operator new can be counted, per thread, so frames can show how
+// many heap allocations they made. That replaces the standard operators
+// for the whole program, so only Debug builds count by default; building
+// a benchmark with COUNT_ALLOCATIONS=1 counts too, and the counts stay at
+// zero otherwise.
+#ifndef COUNT_ALLOCATIONS
+#ifdef DEBUG
+#define COUNT_ALLOCATIONS 1
+#else
+#define COUNT_ALLOCATIONS 0
+#endif
+#endif
+
+// heap allocations made so far by the calling thread; other threads, such
+// as the font loader's, count their own
+unsigned long HeapAllocations();
+
+// --------------------------------------------------------------------------
+// Functions to time the phases of each frame, on the CPU and on the GPU
+
+// the phases of a frame, in the order they run: laying text out again,
+// uploading changed geometry, the tessellated patch pass (or the fill or
+// distance field pass, for text drawn that way), and the pass drawing lines
+// and points
+enum ProfileSection
+{
+    PROFILE_LAYOUT,
+    PROFILE_UPLOAD,
+    PROFILE_PATCHES,
+    PROFILE_LINES,
+    PROFILE_SECTIONS
+};
+
+// number of frames whose GPU timer queries can be in flight; results are
+// read this many frames later, by which time the GPU has normally finished
+// them, so reading never stalls the pipeline
+const int PROFILE_LATENCY = 4;
+
+// times of one frame, in milliseconds; GPU times are negative while not
+// known, e.g. for phases that didn't run
+struct FrameProfile
+{
+    double frameCpu;            // from BeginProfileFrame to EndProfileFrame
+    double cpu[PROFILE_SECTIONS];
+    double gpu[PROFILE_SECTIONS];
+    double allocations;         // heap allocations over the same span
+
+    FrameProfile();
+};
+
+struct Profiler
+{
+    bool    enabled;            // timing is skipped entirely when not
+    bool    inFrame;
+
+    // ring of frames in flight: the GL_TIME_ELAPSED query of each phase,
+    // whether it ran, and when it started and ended on the CPU (seconds
+    // since the profiler was created)
+    GLuint  queries[PROFILE_LATENCY][PROFILE_SECTIONS];
+    bool    issued[PROFILE_LATENCY][PROFILE_SECTIONS];
+    double  cpuStart[PROFILE_LATENCY][PROFILE_SECTIONS];
+    double  cpuEnd[PROFILE_LATENCY][PROFILE_SECTIONS];
+    double  frameStart[PROFILE_LATENCY];
+    double  frameEnd[PROFILE_LATENCY];
+    unsigned long allocationsStart[PROFILE_LATENCY];
+    unsigned long allocationsEnd[PROFILE_LATENCY];
+    bool    pending[PROFILE_LATENCY];   // holds a frame not collected yet
+    unsigned long frame;        // frames begun so far
+
+    // the newest frame with all its results in, and a running average
+    FrameProfile latest;
+    FrameProfile average;
+    unsigned long resolved;     // frames averaged so far
+
+    // optional dump of every resolved frame, as CSV rows or trace events
+    std::ofstream dump;
+    bool    traceEvents;
+    bool    firstEvent;
+    std::chrono::steady_clock::time_point epoch;
+
+    // initialize object names to zero (OpenGL reserved value)
+    Profiler();
+};
+
+// creates the timer queries, returning true if successful
+bool InitializeProfiler(Profiler *profiler);
+
+// turns timing on or off; frames in flight are forgotten either way
+void SetProfiling(Profiler *profiler, bool enabled);
+
+// brackets a frame; beginning one first collects the frame run
+// PROFILE_LATENCY frames ago, if its GPU results are in
+void BeginProfileFrame(Profiler *profiler);
+void EndProfileFrame(Profiler *profiler);
+
+// brackets a phase of the current frame; each phase runs at most once a
+// frame, and phases mustn't overlap, as only one GL_TIME_ELAPSED query can
+// be active at a time
+void BeginProfileSection(Profiler *profiler, ProfileSection section);
+void EndProfileSection(Profiler *profiler, ProfileSection section);
+
+// times a phase for the rest of the enclosing scope
+struct ProfileScope
+{
+    Profiler       *profiler;
+    ProfileSection  section;
+
+    ProfileScope(Profiler *profiler, ProfileSection section)
+        : profiler(profiler), section(section)
+    { BeginProfileSection(profiler, section); }
+    ~ProfileScope() { EndProfileSection(profiler, section); }
+};
+
+// writes every frame collected from now on to a file, and turns timing on;
+// files ending in ".json" get Chrome trace events (chrome://tracing), any
+// other name CSV. Returns false if the file can't be created.
+bool OpenProfileDump(Profiler *profiler, const std::string &path);
+
+// short name of a phase, as used in the overlay and the dumps
+const char *ProfileSectionName(ProfileSection section);
+
+// deallocate the queries, and finish the dump
+void DestroyProfiler(Profiler *profiler);
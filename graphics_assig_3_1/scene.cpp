@@ -0,0 +1,404 @@
+#include "scene.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "shader.h"
+
+using namespace std;
+using namespace glm;
+
+bool CheckGLErrors();
+
+// smallest range handed to an object, in vertices; ranges are rounded up to
+// a power of two, so an object that grows a little usually still fits
+static const GLsizei MIN_SCENE_RANGE = SCENE_BLOCK;
+
+// tags written for the vertices of each section, as LoadGeometry expects
+static const GLubyte SECTION_TAGS[SCENE_SECTIONS] = { 2, 3, 1 };
+
+void ClearSceneShape(SceneShape *shape)
+{
+    for (int i = 0; i < SCENE_SECTIONS; i++) {
+        shape->points[i].clear();
+        shape->colours[i].clear();
+    }
+}
+
+SceneArena::SceneArena()
+    : capacity(0), top(0), transformBuffer(0), transformTexture(0), rangesChanged(false),
+      rangesBase(0), objectsWritten(0), transformsWritten(0), drawCalls(0)
+{}
+
+// the regions an object can be missing from
+static unsigned int AllRegions(const SceneArena *arena)
+{
+    return arena->geometry.streaming ? (1u << STREAM_REGIONS) - 1 : 1u;
+}
+
+// makes room in the transform buffer for the blocks of every region, and
+// points the buffer texture at it
+static bool ReserveSceneTransforms(SceneArena *arena)
+{
+    GLsizeiptr rows = GLsizeiptr(STREAM_REGIONS) * (arena->capacity / SCENE_BLOCK) * 2;
+    glBindBuffer(GL_TEXTURE_BUFFER, arena->transformBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, rows * sizeof(vec4), 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, arena->transformTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, arena->transformBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    return !CheckGLErrors();
+}
+
+bool InitializeSceneArena(SceneArena *arena, GLsizei capacity)
+{
+    // whole blocks, so every region starts on one
+    arena->capacity = (std::max(capacity, MIN_SCENE_RANGE) + SCENE_BLOCK - 1) / SCENE_BLOCK * SCENE_BLOCK;
+    arena->top = 0;
+    arena->objects.clear();
+    arena->freeHandles.clear();
+    arena->freeRanges.clear();
+    arena->rangesChanged = true;
+
+    glGenBuffers(1, &arena->transformBuffer);
+    glGenTextures(1, &arena->transformTexture);
+
+    return InitializeVAO(&arena->geometry, COLOURED_VERTICES, true) &&
+           ReserveGeometry(&arena->geometry, arena->capacity) &&
+           ReserveSceneTransforms(arena);
+}
+
+static bool IsSceneObject(const SceneArena *arena, SceneHandle handle)
+{
+    if (handle < 0 || size_t(handle) >= arena->objects.size() || !arena->objects[handle].live) {
+        cout << "Scene object " << handle << " doesn't exist" << endl;
+        return false;
+    }
+    return true;
+}
+
+SceneHandle AddSceneObject(SceneArena *arena, const SceneShape &shape, const mat4 &transform)
+{
+    SceneHandle handle;
+    if (!arena->freeHandles.empty()) {
+        handle = arena->freeHandles.back();
+        arena->freeHandles.pop_back();
+    } else {
+        handle = SceneHandle(arena->objects.size());
+        arena->objects.push_back(SceneObject());
+    }
+
+    SceneObject &object = arena->objects[handle];
+    object.shape = shape;
+    object.transform = transform;
+    object.live = true;
+    object.dirty = true;
+    return handle;
+}
+
+void SetSceneShape(SceneArena *arena, SceneHandle handle, const SceneShape &shape)
+{
+    if (!IsSceneObject(arena, handle)) return;
+
+    SceneObject &object = arena->objects[handle];
+    object.shape = shape;
+    object.dirty = true;
+}
+
+void SetSceneTransform(SceneArena *arena, SceneHandle handle, const mat4 &transform)
+{
+    if (!IsSceneObject(arena, handle)) return;
+
+    SceneObject &object = arena->objects[handle];
+    object.transform = transform;
+    object.staleTransforms = AllRegions(arena);
+}
+
+// returns a range to the free list, merging it with its neighbours, and
+// lowers the top past any free ranges that end there
+static void ReleaseRange(SceneArena *arena, GLint first, GLsizei count)
+{
+    vector<pair<GLint, GLsizei> > &ranges = arena->freeRanges;
+    vector<pair<GLint, GLsizei> >::iterator next =
+        lower_bound(ranges.begin(), ranges.end(), make_pair(first, count));
+    next = ranges.insert(next, make_pair(first, count));
+
+    if (next + 1 != ranges.end() && next->first + next->second == (next + 1)->first) {
+        next->second += (next + 1)->second;
+        ranges.erase(next + 1);
+    }
+    if (next != ranges.begin() && (next - 1)->first + (next - 1)->second == next->first) {
+        (next - 1)->second += next->second;
+        ranges.erase(next);
+    }
+
+    while (!ranges.empty() && ranges.back().first + ranges.back().second == arena->top) {
+        arena->top = ranges.back().first;
+        ranges.pop_back();
+    }
+}
+
+// finds the first free range the count fits in, or else takes it from the
+// top, which may then pass the capacity until the arena grows
+static GLint AllocateRange(SceneArena *arena, GLsizei count)
+{
+    vector<pair<GLint, GLsizei> > &ranges = arena->freeRanges;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if (ranges[i].second < count) continue;
+
+        GLint first = ranges[i].first;
+        ranges[i].first += count;
+        ranges[i].second -= count;
+        if (ranges[i].second == 0) ranges.erase(ranges.begin() + i);
+        return first;
+    }
+
+    GLint first = arena->top;
+    arena->top += count;
+    return first;
+}
+
+void RemoveSceneObject(SceneArena *arena, SceneHandle handle)
+{
+    if (!IsSceneObject(arena, handle)) return;
+
+    SceneObject &object = arena->objects[handle];
+    if (object.first >= 0) {
+        ReleaseRange(arena, object.first, object.capacity);
+    }
+
+    ClearSceneShape(&object.shape);
+    object.first = -1;
+    object.capacity = 0;
+    object.staleRegions = 0;
+    object.staleTransforms = 0;
+    object.live = false;
+    object.dirty = false;
+    arena->freeHandles.push_back(handle);
+    arena->rangesChanged = true;
+}
+
+// vertices of an object's shape, in all its sections
+static GLsizei ShapeVertexCount(const SceneShape &shape)
+{
+    size_t count = 0;
+    for (int i = 0; i < SCENE_SECTIONS; i++) {
+        count += shape.points[i].size();
+    }
+    return GLsizei(count);
+}
+
+// copies an object's sections into the staging vectors and uploads them to
+// its range of the current region
+static bool WriteSceneObject(SceneArena *arena, SceneObject *object)
+{
+    arena->points.clear();
+    arena->colours.clear();
+    arena->tags.clear();
+
+    for (int i = 0; i < SCENE_SECTIONS; i++) {
+        const vector<vec2> &points = object->shape.points[i];
+        const vector<vec3> &colours = object->shape.colours[i];
+
+        for (size_t k = 0; k < points.size(); k++) {
+            arena->points.push_back(points[k]);
+            arena->colours.push_back(k < colours.size() ? colours[k] : object->shape.colour);
+        }
+        arena->tags.resize(arena->points.size(), SECTION_TAGS[i]);
+    }
+
+    arena->objectsWritten++;
+    return UpdateGeometry(&arena->geometry, object->first, GLsizei(arena->points.size()),
+                          arena->points.data(), arena->colours.data(), arena->tags.data());
+}
+
+// writes the rows of an object's transform to the entries of its blocks in
+// the current region, which the GPU is done reading, as the geometry's are;
+// returns false if they couldn't be written
+static bool WriteSceneTransform(SceneArena *arena, const SceneObject *object)
+{
+    const mat4 &m = object->transform;
+    vec4 x(m[0][0], m[1][0], m[3][0], 0.f);
+    vec4 y(m[0][1], m[1][1], m[3][1], 0.f);
+
+    arena->transformRows.clear();
+    for (GLsizei i = 0; i < object->capacity; i += SCENE_BLOCK) {
+        arena->transformRows.push_back(x);
+        arena->transformRows.push_back(y);
+    }
+
+    GLintptr offset = GLintptr(arena->geometry.firstElement + object->first) / SCENE_BLOCK * 2 * sizeof(vec4);
+    GLsizeiptr bytes = GLsizeiptr(arena->transformRows.size() * sizeof(vec4));
+    glBindBuffer(GL_TEXTURE_BUFFER, arena->transformBuffer);
+    void *range = glMapBufferRange(GL_TEXTURE_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    bool written = range != 0;
+    if (range) {
+        memcpy(range, arena->transformRows.data(), bytes);
+        written = glUnmapBuffer(GL_TEXTURE_BUFFER) == GL_TRUE;
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    if (!written) {
+        cout << "Scene object transforms couldn't be written" << endl;
+        CheckGLErrors();
+        return false;
+    }
+    arena->transformsWritten++;
+    return true;
+}
+
+// the ranges every section is drawn from in the current region, object by
+// object
+static void RebuildSceneRanges(SceneArena *arena)
+{
+    arena->rangesBase = arena->geometry.firstElement;
+    for (int i = 0; i < SCENE_SECTIONS; i++) {
+        arena->sectionFirsts[i].clear();
+        arena->sectionCounts[i].clear();
+    }
+
+    for (const SceneObject &object : arena->objects) {
+        if (!object.live || object.first < 0) continue;
+
+        GLint first = arena->rangesBase + object.first;
+        for (int i = 0; i < SCENE_SECTIONS; i++) {
+            if (object.counts[i] > 0) {
+                arena->sectionFirsts[i].push_back(first);
+                arena->sectionCounts[i].push_back(object.counts[i]);
+            }
+            first += object.counts[i];
+        }
+    }
+    arena->rangesChanged = false;
+}
+
+bool UpdateSceneArena(SceneArena *arena)
+{
+    arena->objectsWritten = 0;
+    arena->transformsWritten = 0;
+    arena->drawCalls = 0;
+
+    Geometry *geometry = &arena->geometry;
+    unsigned int allRegions = AllRegions(arena);
+
+    // objects that changed are missing from every region; those that
+    // outgrew their ranges, or are new, move to free ones, and take their
+    // transforms along
+    for (SceneObject &object : arena->objects) {
+        if (!object.live || !object.dirty) continue;
+
+        GLsizei count = ShapeVertexCount(object.shape);
+        if (object.first < 0 || count > object.capacity) {
+            if (object.first >= 0) {
+                ReleaseRange(arena, object.first, object.capacity);
+            }
+            GLsizei capacity = MIN_SCENE_RANGE;
+            while (capacity < count) capacity *= 2;
+            object.first = AllocateRange(arena, capacity);
+            object.capacity = capacity;
+            object.staleTransforms = allRegions;
+            arena->rangesChanged = true;
+        }
+
+        for (int i = 0; i < SCENE_SECTIONS; i++) {
+            if (object.counts[i] != GLsizei(object.shape.points[i].size())) {
+                object.counts[i] = GLsizei(object.shape.points[i].size());
+                arena->rangesChanged = true;
+            }
+        }
+        object.staleRegions = allRegions;
+        object.dirty = false;
+    }
+
+    // reallocating the buffers loses what every region held, so every
+    // object is written again; doubling keeps that from happening often
+    if (arena->top > arena->capacity) {
+        GLsizei capacity = arena->capacity;
+        while (capacity < arena->top) capacity *= 2;
+        if (!ReserveGeometry(geometry, capacity)) return false;
+        arena->capacity = capacity;
+        if (!ReserveSceneTransforms(arena)) return false;
+
+        for (SceneObject &object : arena->objects) {
+            object.staleRegions = object.live ? allRegions : 0;
+            object.staleTransforms = object.staleRegions;
+        }
+    }
+
+    // the region drawn last is drawn again as long as it's up to date;
+    // otherwise the next one is brought up to date and drawn instead
+    unsigned int current = 1u << geometry->streamRegion;
+    bool changed = false;
+    for (const SceneObject &object : arena->objects) {
+        changed = changed || (object.live && ((object.staleRegions | object.staleTransforms) & current));
+    }
+
+    bool success = true;
+    if (changed) {
+        unsigned int region = 1u << BeginGeometryUpdate(geometry);
+        for (SceneObject &object : arena->objects) {
+            if (!object.live) continue;
+
+            if (object.staleRegions & region) {
+                success = WriteSceneObject(arena, &object) && success;
+                object.staleRegions &= ~region;
+            }
+            // a transform that couldn't be written stays stale, so it's
+            // tried again when the region next comes round
+            if (object.staleTransforms & region) {
+                if (WriteSceneTransform(arena, &object)) {
+                    object.staleTransforms &= ~region;
+                } else {
+                    success = false;
+                }
+            }
+        }
+    }
+
+    if (arena->rangesChanged || arena->rangesBase != geometry->firstElement) {
+        RebuildSceneRanges(arena);
+    }
+    return success;
+}
+
+void BindSceneArena(const SceneArena *arena)
+{
+    BindGeometry(&arena->geometry);
+    glActiveTexture(GL_TEXTURE0 + OBJECT_TRANSFORMS_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, arena->transformTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void DrawSceneSection(SceneArena *arena, SceneSection section, GLenum mode)
+{
+    const vector<GLint> &firsts = arena->sectionFirsts[section];
+    if (firsts.empty()) return;
+
+    glMultiDrawArrays(mode, firsts.data(), arena->sectionCounts[section].data(), GLsizei(firsts.size()));
+    arena->drawCalls++;
+}
+
+void FenceSceneArena(SceneArena *arena)
+{
+    FenceGeometry(&arena->geometry);
+}
+
+void DestroySceneArena(SceneArena *arena)
+{
+    DestroyGeometry(&arena->geometry);
+    glDeleteTextures(1, &arena->transformTexture);
+    glDeleteBuffers(1, &arena->transformBuffer);
+    arena->transformTexture = 0;
+    arena->transformBuffer = 0;
+    arena->objects.clear();
+    arena->freeHandles.clear();
+    arena->freeRanges.clear();
+    for (int i = 0; i < SCENE_SECTIONS; i++) {
+        arena->sectionFirsts[i].clear();
+        arena->sectionCounts[i].clear();
+    }
+    arena->capacity = 0;
+    arena->top = 0;
+}
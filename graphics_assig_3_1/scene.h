@@ -0,0 +1,143 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "geometry.h"
+
+// --------------------------------------------------------------------------
+// Functions to keep many independent outlined objects, such as the labels
+// of a dashboard, in one shared vertex buffer
+
+// Every object's vertices are sub-allocated from one arena, in sections
+// that are drawn by different programs. Each section is drawn for all the
+// objects at once with a single multi-draw, so the number of draw calls
+// doesn't grow with the number of objects, and changing an object only
+// rewrites its own range of the arena. The arena is streaming geometry, so
+// that range is written to a ring region the GPU is no longer drawing from,
+// and every region is brought up to date in turn as it comes round.
+//
+// Objects are transformed by the vertex shader, from a table with an entry
+// for every SCENE_BLOCK vertices of the arena, so moving an object only
+// rewrites the entries of its range and none of its vertices. Programs
+// drawing an arena are compiled with OBJECT_BLOCK defined as SCENE_BLOCK.
+enum SceneSection
+{
+    SCENE_QUADRATICS,       // patches of degree 2, four control points each
+    SCENE_CUBICS,           // patches of degree 3
+    SCENE_LINES,            // pairs of end points
+    SCENE_SECTIONS
+};
+
+// The vertices of an object in its own coordinates, by section. Colours
+// are per vertex, or the shape's colour for sections that have none.
+struct SceneShape
+{
+    std::vector<glm::vec2> points[SCENE_SECTIONS];
+    std::vector<glm::vec3> colours[SCENE_SECTIONS];
+    glm::vec3 colour;
+
+    SceneShape() : colour(1.f, 1.f, 1.f) {}
+};
+
+// empties every section of a shape, keeping its storage for reuse
+void ClearSceneShape(SceneShape *shape);
+
+typedef int SceneHandle;
+const SceneHandle NO_SCENE_OBJECT = -1;
+
+// ranges are handed out in multiples of this many vertices, each block
+// with the transform of its object
+const GLsizei SCENE_BLOCK = 64;
+
+struct SceneObject
+{
+    SceneShape  shape;
+    glm::mat4   transform;      // its 2D affine part is applied when drawn
+    GLint       first;          // of its range of the arena, -1 if it has none
+    GLsizei     capacity;       // vertices its range holds
+    GLsizei     counts[SCENE_SECTIONS];    // vertices of each section in it
+    unsigned int staleRegions;  // bits of the ring regions not holding it yet
+    unsigned int staleTransforms;   // and not holding its transform yet
+    bool        live;           // not removed
+    bool        dirty;          // its shape changed since the last update
+
+    SceneObject()
+        : transform(1.f), first(-1), capacity(0), counts(), staleRegions(0), staleTransforms(0),
+          live(false), dirty(false)
+    {}
+};
+
+struct SceneArena
+{
+    Geometry    geometry;       // coloured, tagged vertices of every object
+    GLsizei     capacity;       // vertices the buffers hold
+    GLsizei     top;            // end of the ranges handed out so far
+
+    // two rows of a transform for every block of every ring region, read
+    // through a buffer texture
+    GLuint      transformBuffer;
+    GLuint      transformTexture;
+
+    // objects by handle; handles and ranges of removed objects are reused
+    std::vector<SceneObject> objects;
+    std::vector<SceneHandle> freeHandles;
+    std::vector<std::pair<GLint, GLsizei> > freeRanges;    // sorted by first
+
+    // the ranges of each section across all the objects, for multi-draws;
+    // rebuilt when an object's sections change size or move
+    std::vector<GLint>   sectionFirsts[SCENE_SECTIONS];
+    std::vector<GLsizei> sectionCounts[SCENE_SECTIONS];
+    bool        rangesChanged;
+    GLint       rangesBase;     // first element of the region they were built for
+
+    // staging for the object being written
+    std::vector<glm::vec2> points;
+    std::vector<glm::vec3> colours;
+    std::vector<GLubyte>   tags;
+    std::vector<glm::vec4> transformRows;
+
+    // objects and transforms written by the last update (each change is
+    // written once to every region, over as many frames), and draws issued
+    // since the last one, to show that they all stay small
+    size_t      objectsWritten;
+    size_t      transformsWritten;
+    size_t      drawCalls;
+
+    SceneArena();
+};
+
+// creates the arena's buffers with room for capacity vertices; the arena
+// grows on its own if objects need more
+bool InitializeSceneArena(SceneArena *arena, GLsizei capacity);
+
+// adds an object, which is written to the arena by the next update
+SceneHandle AddSceneObject(SceneArena *arena, const SceneShape &shape,
+                           const glm::mat4 &transform = glm::mat4(1.f));
+
+// replaces an object's shape, which only rewrites its own range unless it no
+// longer fits in it, or its transform, which only rewrites its entries
+void SetSceneShape(SceneArena *arena, SceneHandle handle, const SceneShape &shape);
+void SetSceneTransform(SceneArena *arena, SceneHandle handle, const glm::mat4 &transform);
+
+void RemoveSceneObject(SceneArena *arena, SceneHandle handle);
+
+// finds ranges for new and grown objects; if anything changed, moves on to
+// the next ring region and writes every object that region is missing into
+// its range. Returns false on failure.
+bool UpdateSceneArena(SceneArena *arena);
+
+// binds the arena's geometry, and its transforms to OBJECT_TRANSFORMS_UNIT
+void BindSceneArena(const SceneArena *arena);
+
+// draws one section of every object with the bound program, in one call;
+// the arena must be bound
+void DrawSceneSection(SceneArena *arena, SceneSection section, GLenum mode);
+
+// fences the region the frame's sections were drawn from; call it after the
+// last of them
+void FenceSceneArena(SceneArena *arena);
+
+// deallocate the arena's buffers
+void DestroySceneArena(SceneArena *arena);
@@ -0,0 +1,170 @@
+#include "shader.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace std;
+using namespace glm;
+
+bool CheckGLErrors();
+
+ShaderProgram::ShaderProgram()
+    : program(0), modelTransform(-1), positionScale(-1)
+{}
+
+bool InitializeProgram(ShaderProgram *shader, GLuint program)
+{
+    shader->program = program;
+    if (!program) return false;
+
+    shader->modelTransform = glGetUniformLocation(program, "modelTransform");
+    shader->positionScale = glGetUniformLocation(program, "positionScale");
+
+    // programs whose stages don't use the shared state have no block
+    GLuint block = glGetUniformBlockIndex(program, "FrameUniforms");
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, block, FRAME_UNIFORMS_BINDING);
+    }
+
+    // nor do those of programs not drawing scene arenas have transforms
+    GLint transforms = glGetUniformLocation(program, "objectTransforms");
+    if (transforms >= 0) {
+        glUseProgram(program);
+        glUniform1i(transforms, OBJECT_TRANSFORMS_UNIT);
+        glUseProgram(0);
+    }
+
+    return !CheckGLErrors();
+}
+
+void UseProgram(const ShaderProgram *shader, const mat4 &modelTransform, float positionScale)
+{
+    glUseProgram(shader->program);
+    glUniformMatrix4fv(shader->modelTransform, 1, GL_FALSE, value_ptr(modelTransform));
+    glUniform1f(shader->positionScale, positionScale);
+}
+
+void DestroyProgram(ShaderProgram *shader)
+{
+    glDeleteProgram(shader->program);
+    shader->program = 0;
+}
+
+bool InitializeFrameUniforms(GLuint *buffer)
+{
+    glGenBuffers(1, buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, *buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, *buffer);
+
+    return !CheckGLErrors();
+}
+
+void LoadFrameUniforms(GLuint buffer, const FrameUniforms &uniforms)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// --------------------------------------------------------------------------
+
+// start of a program binary cache file, followed by the binary itself
+struct ProgramBinaryHeader
+{
+    char        magic[8];       // "PROGBIN\0"
+    uint64_t    key;            // hash of the sources, renderer and version
+    uint32_t    format;         // binary format chosen by the driver
+    uint32_t    length;         // bytes of binary that follow
+};
+
+static const char PROGRAM_BINARY_MAGIC[8] = { 'P', 'R', 'O', 'G', 'B', 'I', 'N', 0 };
+
+static bool ProgramBinarySupported()
+{
+    return GLAD_GL_ARB_get_program_binary && glGetProgramBinary && glProgramBinary;
+}
+
+// 64-bit FNV-1a hash of the sources and the driver they're linked by; a
+// length goes in before each string, so sources can't run into each other
+static uint64_t ProgramBinaryKey(const vector<string> &sources)
+{
+    vector<string> parts = sources;
+    const char *renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+    const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+    parts.push_back(renderer ? renderer : "");
+    parts.push_back(version ? version : "");
+
+    uint64_t hash = 14695981039346656037ull;
+    for (const string &part : parts) {
+        uint64_t length = part.size();
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&length);
+        for (size_t i = 0; i < sizeof(length); i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        for (unsigned char c : part) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+GLuint LoadProgramBinary(const string &cacheFile, const vector<string> &sources)
+{
+    if (!ProgramBinarySupported()) return 0;
+
+    ifstream file(cacheFile.c_str(), ios::binary);
+    ProgramBinaryHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) return 0;
+    if (memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC)) != 0 ||
+        header.key != ProgramBinaryKey(sources)) {
+        return 0;
+    }
+
+    vector<char> binary(header.length);
+    if (!file.read(binary.data(), binary.size())) return 0;
+
+    // the driver may still refuse a binary, e.g. after an update that
+    // didn't change its version string
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), binary.size());
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status == GL_FALSE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void SaveProgramBinary(GLuint program, const string &cacheFile, const vector<string> &sources)
+{
+    if (!program || !ProgramBinarySupported()) return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    if (CheckGLErrors()) return;
+
+    ProgramBinaryHeader header;
+    memcpy(header.magic, PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC));
+    header.key = ProgramBinaryKey(sources);
+    header.format = format;
+    header.length = length;
+
+    ofstream file(cacheFile.c_str(), ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(binary.data(), length);
+    if (!file) {
+        cout << "Failed to save program binary " << cacheFile << endl;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// --------------------------------------------------------------------------
+// Shader programs, with their uniform locations resolved once at link time
+
+// binding point of the FrameUniforms block shared by all programs
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+
+// texture unit of the objectTransforms buffer of programs drawing scene
+// arenas, clear of the units other programs sample
+const GLuint OBJECT_TRANSFORMS_UNIT = 1;
+
+// Scene state shared by every program and updated once per frame. The
+// layout follows std140, matching the FrameUniforms block in the shaders.
+struct FrameUniforms
+{
+    glm::vec2 viewportSize;     // in pixels
+    float     scaleBy;          // fits the demo figures to the window
+    float     shiftBy;
+    float     flatness;         // of tessellated curves, in pixels
+    float     padding[3];       // std140 rounds blocks up to 16 bytes
+};
+
+struct ShaderProgram
+{
+    GLuint  program;
+
+    // locations of the uniforms set for every draw, or -1 if unused
+    GLint   modelTransform;
+    GLint   positionScale;
+
+    // initialize object names to zero (OpenGL reserved value)
+    ShaderProgram();
+};
+
+// takes ownership of a linked program, looking up its uniform locations and
+// attaching its FrameUniforms block, returning true if successful
+bool InitializeProgram(ShaderProgram *shader, GLuint program);
+
+// binds the program, setting the placement of the geometry about to be drawn
+void UseProgram(const ShaderProgram *shader, const glm::mat4 &modelTransform, float positionScale);
+
+// deallocate the program object
+void DestroyProgram(ShaderProgram *shader);
+
+// creates the uniform buffer of the FrameUniforms block, bound to its
+// binding point, returning true if successful
+bool InitializeFrameUniforms(GLuint *buffer);
+
+// replaces the contents of the FrameUniforms block
+void LoadFrameUniforms(GLuint buffer, const FrameUniforms &uniforms);
+
+// Linked programs saved from an earlier run (ARB_get_program_binary). A
+// cache file is only used for the same shader sources, renderer and driver
+// version it was saved with; otherwise, or if the driver rejects it, the
+// program has to be compiled as usual, and saved again.
+
+// returns a program loaded from the cache file, or 0 if there is no usable one
+GLuint LoadProgramBinary(const std::string &cacheFile, const std::vector<std::string> &sources);
+
+// saves a linked program to the cache file, for the next run
+void SaveProgramBinary(GLuint program, const std::string &cacheFile,
+                       const std::vector<std::string> &sources);
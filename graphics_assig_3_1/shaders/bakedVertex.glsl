@@ -0,0 +1,21 @@
+// ==========================================================================
+// Vertex program drawing tessellated curves captured by transform feedback
+//
+// The captured points are already in clip space, coloured as the patches
+// were, so they are passed straight on to the fragment stage.
+// ==========================================================================
+#version 410
+
+// location indices for these attributes correspond to those specified in the
+// InitializeCapture() function of the main program
+layout(location = 0) in vec4 VertexPosition;
+layout(location = 1) in vec3 VertexColour;
+
+// output to be interpolated between vertices and passed to the fragment stage
+out vec3 Colour;
+
+void main()
+{
+    gl_Position = VertexPosition;
+    Colour = VertexColour;
+}
@@ -0,0 +1,26 @@
+// ==========================================================================
+// Fragment program for drawing text from the signed distance field atlas
+// ==========================================================================
+#version 410
+
+// interpolated colour and atlas coordinates received from vertex stage
+in vec3 Colour;
+in vec2 TextureCoord;
+
+// distances to the outlines of the glyphs, 0.5 on the outline and growing
+// inwards; read from texture unit 0, the default
+uniform sampler2D glyphDistances;
+
+// first output is mapped to the framebuffer's colour index by default
+out vec4 FragmentColour;
+
+void main(void)
+{
+    // threshold the interpolated distance at the outline, blending over
+    // about a pixel so edges stay smooth at any scale
+    float distance = texture(glyphDistances, TextureCoord).r;
+    float edge = max(0.7 * fwidth(distance), 1e-4);
+    float coverage = smoothstep(0.5 - edge, 0.5 + edge, distance);
+    
+    FragmentColour = vec4(Colour, coverage);
+}
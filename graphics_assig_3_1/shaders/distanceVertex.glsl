@@ -0,0 +1,45 @@
+// ==========================================================================
+// Vertex program for drawing text from the signed distance field atlas
+// ==========================================================================
+#version 410
+
+// location indices for these attributes correspond to those specified in the
+// InitializeGeometry() function of the main program
+layout(location = 0) in vec2 VertexPosition;
+layout(location = 1) in vec3 VertexColour;    // constant if the array is disabled
+
+// offset (xy) and scale (z) of the current instance, e.g. of one character
+// drawing a shared glyph; (0, 0, 1) for geometry that isn't instanced
+layout(location = 2) in vec3 InstancePlacement;
+
+// where the corner of the glyph's quad is in the atlas texture
+layout(location = 4) in vec2 VertexTextureCoord;
+
+// scene state shared by all programs, set once per frame
+layout(std140) uniform FrameUniforms
+{
+    vec2  viewportSize;     // in pixels
+    float scaleBy;          // fits the demo figures to the window
+    float shiftBy;
+    float flatness;         // of tessellated curves, in pixels
+};
+
+// places the geometry in the scene (e.g. scrolls text) without re-uploading it
+uniform mat4 modelTransform;
+
+// compact vertex formats store positions normalized by this factor
+uniform float positionScale;
+
+out vec3 Colour;
+out vec2 TextureCoord;
+
+void main()
+{
+    // place the vertex for its instance and transform it, as for outlines
+    vec2 position = (VertexPosition * positionScale + InstancePlacement.xy) * InstancePlacement.z;
+    position = (modelTransform * vec4(position, 0, 1)).xy;
+    gl_Position = vec4((position + shiftBy) * scaleBy, 0, 1);
+    
+    Colour = VertexColour;
+    TextureCoord = VertexTextureCoord;
+}
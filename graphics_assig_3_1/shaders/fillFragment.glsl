@@ -1,19 +1,21 @@
 // ==========================================================================
-// Vertex program for barebones GLFW boilerplate
-//
-// Author:  Sonny Chan, University of Calgary
-// Date:    December 2015
+// Fragment program for filling text through the stencil buffer
 // ==========================================================================
 #version 410
 
-// interpolated colour received from vertex stage
+// interpolated colour and Loop-Blinn coordinates received from vertex stage
 in vec3 Colour;
+in vec2 CurveCoord;
 
 // first output is mapped to the framebuffer's colour index by default
 out vec4 FragmentColour;
 
 void main(void)
 {
+    // only the part of a curve's triangle between its chord and the curve
+    // itself belongs to the glyph
+    if (CurveCoord.x * CurveCoord.x - CurveCoord.y > 0.0) discard;
+    
     // write colour output without modification
     FragmentColour = vec4(Colour, 0);
 }
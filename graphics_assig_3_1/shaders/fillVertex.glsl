@@ -0,0 +1,51 @@
+// ==========================================================================
+// Vertex program for filling text through the stencil buffer
+// ==========================================================================
+#version 410
+
+// location indices for these attributes correspond to those specified in the
+// InitializeGeometry() function of the main program
+layout(location = 0) in vec2 VertexPosition;
+layout(location = 1) in vec3 VertexColour;    // constant if the array is disabled
+
+// offset (xy) and scale (z) of the current instance, e.g. of one character
+// drawing a shared glyph; (0, 0, 1) for geometry that isn't instanced
+layout(location = 2) in vec3 InstancePlacement;
+
+// which corner of a fill triangle the vertex is (see FillCorner in the main
+// program): any corner of an interior triangle, or the start, control point
+// or end of a quadratic curve
+layout(location = 3) in int VertexCorner;
+
+// scene state shared by all programs, set once per frame
+layout(std140) uniform FrameUniforms
+{
+    vec2  viewportSize;     // in pixels
+    float scaleBy;          // fits the demo figures to the window
+    float shiftBy;
+    float flatness;         // of tessellated curves, in pixels
+};
+
+// places the geometry in the scene (e.g. scrolls text) without re-uploading it
+uniform mat4 modelTransform;
+
+// compact vertex formats store positions normalized by this factor
+uniform float positionScale;
+
+// Loop-Blinn coordinates of each corner; a quadratic is u^2 = v over the
+// triangle around it, and interior triangles are inside everywhere
+const vec2 CORNERS[4] = vec2[4](vec2(0, 1), vec2(0, 0), vec2(0.5, 0), vec2(1, 1));
+
+out vec3 Colour;
+out vec2 CurveCoord;
+
+void main()
+{
+    // place the vertex for its instance and transform it, as for outlines
+    vec2 position = (VertexPosition * positionScale + InstancePlacement.xy) * InstancePlacement.z;
+    position = (modelTransform * vec4(position, 0, 1)).xy;
+    gl_Position = vec4((position + shiftBy) * scaleBy, 0, 1);
+    
+    Colour = VertexColour;
+    CurveCoord = CORNERS[VertexCorner];
+}
@@ -15,22 +15,86 @@ layout(vertices = 4) out;
 in vec3 tcColour[];		//From vertex shader
 out vec3 teColour[];	//To fragment shader
 
+//Degree of the curve, the same for every control point of the patch;
+//programs specialized for one degree have it defined as PATCH_DEGREE
+#ifndef PATCH_DEGREE
+flat in int tcDegree[];
+patch out int teDegree;
+#endif
+
+//Scene state shared by all programs: the size of the viewport in pixels,
+//and the flatness, the largest distance in pixels the tessellated lines may
+//stray from the true curve
+layout(std140) uniform FrameUniforms
+{
+	vec2  viewportSize;
+	float scaleBy;
+	float shiftBy;
+	float flatness;
+};
+
 //Variables which are implicitly included in every tess control shader
 //Struct containing gl_Position, gl_PointSize, and something else you'll probably never use
 //in gl_in[];
 //Structs containing the same information which can be written to to send to Tess Eval shader
 //out gl_out[];		
 
+#define MAX_LEVEL 64.0
+
+//Control point in pixels
+vec2 screenPoint(int i)
+{
+	return gl_in[i].gl_Position.xy * 0.5 * viewportSize;
+}
+
+//True if the patch is a line: every control point lies on the chord between
+//its ends, so the curve never leaves it
+bool isStraight(int degree)
+{
+	vec2 start = screenPoint(0);
+	vec2 chord = screenPoint(degree) - start;
+	float length2 = dot(chord, chord);
+	if (length2 == 0.0) return false;
+
+	for (int i = 1; i < degree; i++) {
+		vec2 offset = screenPoint(i) - start;
+		float along = dot(offset, chord) / length2;
+		float across = abs(offset.x * chord.y - offset.y * chord.x) * inversesqrt(length2);
+		if (along < 0.0 || along > 1.0 || across > flatness) return false;
+	}
+	return true;
+}
+
+//Segments needed to stay within flatness of a Bezier curve of the given
+//degree, from Wang's formula: sqrt(n(n-1)/8 * max|P[i] - 2P[i+1] + P[i+2]| / tol)
+float curveLevel(int degree)
+{
+	float bend = 0.0;
+	for (int i = 0; i + 2 <= degree; i++) {
+		bend = max(bend, length(screenPoint(i) - 2.0 * screenPoint(i + 1) + screenPoint(i + 2)));
+	}
+	float n = float(degree);
+	return ceil(sqrt(n * (n - 1.0) * bend / (8.0 * flatness)));
+}
+
 void main()
 {
 	//gl_InvocationID says which vertex in the patch you are processing
 	if(gl_InvocationID == 0)
 	{
+#ifdef PATCH_DEGREE
+		const int degree = PATCH_DEGREE;
+#else
+		int degree = tcDegree[0];
+		teDegree = degree;
+#endif
+		float level = isStraight(degree) ? 1.0 : curveLevel(degree);
+
 		gl_TessLevelOuter[0] = 1;		//Determines number of lines
-		gl_TessLevelOuter[1] = 64;		//Determines number of segments in line
+		gl_TessLevelOuter[1] = clamp(level, 1.0, MAX_LEVEL);	//Determines number of segments in line
 	}
 
 	//Passing information along to tessEval.glsl
 	gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
 	teColour[gl_InvocationID] = tcColour[gl_InvocationID];
-}
+}
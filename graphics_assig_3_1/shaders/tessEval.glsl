@@ -12,11 +12,12 @@ layout(isolines) in;
 in vec3 teColour[];
 //in gl_in[];
 
-uniform float quadratic;
-uniform float cubic;
-
-uniform float scaleBy;
-uniform float shiftBy;
+//Degree of the curve; quadratic patches ignore their last control point.
+//Programs specialized for one degree have it defined as PATCH_DEGREE, and
+//those drawing in a single colour (text) have FLAT_COLOUR defined
+#ifndef PATCH_DEGREE
+patch in int teDegree;
+#endif
 
 //Information being sent out to fragment shader
 //Will be interpolated as if sent from vertex shader
@@ -30,9 +31,13 @@ vec2 quadraticBezier(float u, vec2 p0, vec2 p1, vec2 p2)
     float b1 = 2.f * u * (1.f - u);
     float b2 = u * u;
     
+#ifdef FLAT_COLOUR
+    Colour = teColour[0];
+#else
     Colour = teColour[0] * b0 +
              teColour[1] * b1 +
              teColour[2] * b2;
+#endif
     
     return (b0 * p0) + (b1 * p1) + (b2 * p2);
 }
@@ -44,10 +49,14 @@ vec2 cubicBezier(float u, vec2 p0, vec2 p1, vec2 p2, vec2 p3)
     float b2 = 3. * u * u * (1. - u);
     float b3 = u * u * u;
     
+#ifdef FLAT_COLOUR
+    Colour = teColour[0];
+#else
     Colour = teColour[0] * b0 +
              teColour[1] * b1 +
              teColour[2] * b2 +
              teColour[3] * b3;
+#endif
     
     return (b0 * p0) + (b1 * p1) + (b2 * p2) + (b3 * p3);
 }
@@ -58,20 +67,23 @@ void main()
     //gl_TessCoord.y will parameterize the number of lines from 0 to 1
     float u = gl_TessCoord.x;
     
-    vec3 startColour = teColour[0];
-    vec3 endColour = teColour[1];
-    
     vec2 p0 = gl_in[0].gl_Position.xy;
     vec2 p1 = gl_in[1].gl_Position.xy;
     vec2 p2 = gl_in[2].gl_Position.xy;
-    vec2 p3 = gl_in[3].gl_Position.xy;
     
+    //the last control point is only read by cubics
     vec2 position = vec2(0.f);
-    if (cubic == 1) {
-        position = cubicBezier(u, p0, p1, p2, p3);
-    } else if (quadratic == 1) {
+#if !defined(PATCH_DEGREE)
+    if (teDegree == 3) {
+        position = cubicBezier(u, p0, p1, p2, gl_in[3].gl_Position.xy);
+    } else {
         position = quadraticBezier(u, p0, p1, p2);
     }
+#elif PATCH_DEGREE == 3
+    position = cubicBezier(u, p0, p1, p2, gl_in[3].gl_Position.xy);
+#else
+    position = quadraticBezier(u, p0, p1, p2);
+#endif
     
-    gl_Position = vec4((position + shiftBy) * scaleBy, 0, 1);
+    gl_Position = vec4(position, 0, 1);
 }
@@ -3,22 +3,79 @@
 //
 // Author:  Sonny Chan, University of Calgary
 // Date:    December 2015
+//
+// Compiled with OVERLAY defined, it draws the control points and straight
+// lines as they are instead of passing control points on to tessellation.
+// Compiled with OBJECT_BLOCK defined, it draws a scene arena, transforming
+// each vertex by the object whose range it is in.
 // ==========================================================================
 #version 410
 
 // location indices for these attributes correspond to those specified in the
 // InitializeGeometry() function of the main program
 layout(location = 0) in vec2 VertexPosition;
-layout(location = 1) in vec3 VertexColour;
+layout(location = 1) in vec3 VertexColour;    // constant if the array is disabled
+
+// offset (xy) and scale (z) of the current instance, e.g. of one character
+// drawing a shared glyph; (0, 0, 1) for geometry that isn't instanced
+layout(location = 2) in vec3 InstancePlacement;
+
+// degree of the patch this control point belongs to: patches always have
+// four control points, and quadratics leave the last one unused
+layout(location = 3) in int VertexDegree;
+
+// places the geometry in the scene (e.g. scrolls text) without re-uploading
+// it; Bezier curves are affine invariant, so transforming the control
+// points here is the same as transforming the tessellated curve
+uniform mat4 modelTransform;
+
+// compact vertex formats store positions normalized by this factor
+uniform float positionScale;
+
+#ifdef OBJECT_BLOCK
+// the x and y rows of a 2D affine transform for every OBJECT_BLOCK vertices,
+// that of the object whose range they are in
+uniform samplerBuffer objectTransforms;
+#endif
+
+// scene state shared by all programs, set once per frame
+layout(std140) uniform FrameUniforms
+{
+    vec2  viewportSize;     // in pixels
+    float scaleBy;          // fits the demo figures to the window
+    float shiftBy;
+    float flatness;         // of tessellated curves, in pixels
+};
 
-// output to be interpolated between vertices and passed to the fragment stage
+// output to be interpolated between vertices and passed to the next stage
+#ifdef OVERLAY
+out vec3 Colour;
+#else
 out vec3 tcColour;
+flat out int tcDegree;
+#endif
 
 void main()
 {
-    // assign vertex position without modification
-    gl_Position = vec4(VertexPosition, 0.0, 1.0);
+    // place the control point for its instance, then transform it into
+    // place; the tessellation stages work on final positions, so they can
+    // measure curves on screen
+    vec2 position = (VertexPosition * positionScale + InstancePlacement.xy) * InstancePlacement.z;
+#ifdef OBJECT_BLOCK
+    int block = gl_VertexID / OBJECT_BLOCK;
+    vec3 point = vec3(position, 1.0);
+    position = vec2(dot(texelFetch(objectTransforms, 2 * block).xyz, point),
+                    dot(texelFetch(objectTransforms, 2 * block + 1).xyz, point));
+#endif
+    position = (modelTransform * vec4(position, 0.0, 1.0)).xy;
+    gl_Position = vec4((position + shiftBy) * scaleBy, 0.0, 1.0);
     
     // assign output colour to be interpolated
+#ifdef OVERLAY
+    gl_PointSize = 8.0;
+    Colour = VertexColour;
+#else
     tcColour = VertexColour;
+    tcDegree = VertexDegree;
+#endif
 }
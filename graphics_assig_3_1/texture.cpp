@@ -35,56 +35,74 @@ MyTexture::MyTexture() : textureID(0), target(0), width(0), height(0)
 	{}
 
 
-bool InitializeTexture(MyTexture* texture, const char* filename, GLenum target)
+bool InitializeTexture(MyTexture* texture, const unsigned char* pixels, int width, int height,
+					   int numComponents, GLenum target)
 {
-	int numComponents;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(filename, &texture->width, &texture->height, &numComponents, 0);
-	if (data != nullptr)
+	//Set number of components by format of the texture
+	GLuint format = GL_RGB;
+	switch(numComponents)
 	{
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);		//Set alignment to be 1
+		case 4:
+			format = GL_RGBA;
+			break;
+		case 3:
+			format = GL_RGB;
+			break;
+		case 2:
+			format = GL_RG;
+			break;
+		case 1:
+			format = GL_RED;
+			break;
+		default:
+			cout << "Invalid Texture Format" << endl;
+			break;
+	};
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);		//Set alignment to be 1
 
+	//Textures created this way before just get their pixels replaced
+	if (!texture->textureID)
+	{
 		texture->target = target;
 		glGenTextures(1, &texture->textureID);
-		glBindTexture(texture->target, texture->textureID);
-
-		//Set number of components by format of the texture
-		GLuint format = GL_RGB;
-		switch(numComponents)
-		{
-			case 4:
-				format = GL_RGBA;
-				break;
-			case 3:
-				format = GL_RGB;
-				break;
-			case 2:
-				format = GL_RG;
-				break;
-			case 1:
-				format = GL_RED;
-				break;
-			default:
-				cout << "Invalid Texture Format" << endl;
-				break;
-		};
-		//Loads texture data into bound texture
-		glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, data);
-
-		//Modifies behaviour for bound texture
-		// Note: Only wrapping modes supported for GL_TEXTURE_RECTANGLE when defining
-		// GL_TEXTURE_WRAP are GL_CLAMP_TO_EDGE or GL_CLAMP_TO_BORDER
-		glTexParameteri(texture->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(texture->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	texture->width = width;
+	texture->height = height;
+	glBindTexture(texture->target, texture->textureID);
+
+	//Loads texture data into bound texture
+	glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, pixels);
+
+	//Modifies behaviour for bound texture
+	// Note: Only wrapping modes supported for GL_TEXTURE_RECTANGLE when defining
+	// GL_TEXTURE_WRAP are GL_CLAMP_TO_EDGE or GL_CLAMP_TO_BORDER
+	glTexParameteri(texture->target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(texture->target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(texture->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// Clean up
+	glBindTexture(texture->target, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);	//Return to default alignment
+
+	return !CheckGLErrors("Loading texture: ");
+}
+
+bool InitializeTexture(MyTexture* texture, const char* filename, GLenum target)
+{
+	int width, height, numComponents;
+	stbi_set_flip_vertically_on_load(true);
+	unsigned char *data = stbi_load(filename, &width, &height, &numComponents, 0);
+	if (data != nullptr)
+	{
+		bool loaded = InitializeTexture(texture, data, width, height, numComponents, target);
 
 		// Clean up
-		glBindTexture(texture->target, 0);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);	//Return to default alignment
 		stbi_image_free(data);
 
-		return !CheckGLErrors( (string("Loading texture: ")+filename).c_str() );
+		if (!loaded) cout << "Loading texture: " << filename << endl;
+		return loaded;
 	}
 
 	return true; //error
@@ -29,5 +29,14 @@ struct MyTexture
 //	target - Type of texture generated, eg GL_TEXTURE_2D and GL_TEXTURE_RECTANGLE
 bool InitializeTexture(MyTexture* texture, const char* filename, GLenum target = GL_TEXTURE_2D);
 
+//Function to create a texture from pixels in memory, or to replace all of
+//the pixels of a texture created before
+// ARGS:
+//	texture - Properties of created texture is returned here
+//	pixels - Rows of pixels, bottom first, of numComponents bytes each
+//	target - Type of texture generated, eg GL_TEXTURE_2D and GL_TEXTURE_RECTANGLE
+bool InitializeTexture(MyTexture* texture, const unsigned char* pixels, int width, int height,
+					   int numComponents, GLenum target = GL_TEXTURE_2D);
+
 // deallocate texture-related objects
 void DestroyTexture(MyTexture *texture);
\ No newline at end of file